@@ -3,6 +3,9 @@
 //
 
 #include "Primitive.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 
@@ -15,8 +18,8 @@ Primitive::Texture::Texture(const std::string &name) {
     cv::cvtColor(image_data, image_data, cv::COLOR_RGB2BGR);
 }
 
-Eigen::Vector3f Primitive::Texture::getValue(float u, float v) {
-    if (image_data.empty()) return {128, 128, 128};
+Eigen::Vector3f Primitive::Texture::getValue(float u, float v) const {
+    if (isEmpty()) return {128, 128, 128};
     if (u < 0) u = 0;
     else if (u > 1) u = 1;
     if (v < 0) v = 0;
@@ -28,15 +31,12 @@ Eigen::Vector3f Primitive::Texture::getValue(float u, float v) {
     return res;
 }
 
+// release this reference to the image, other textures sharing it keep it
 void Primitive::Texture::cleanData() {
     image_data.release();
 }
 
-void Primitive::Texture::copyTo(Primitive::Texture &dest) {
-    image_data.copyTo(dest.image_data);
-}
-
-bool Primitive::Texture::isEmpty() {
+bool Primitive::Texture::isEmpty() const {
     return image_data.empty();
 }
 
@@ -47,7 +47,64 @@ Primitive::GPUVertex::GPUVertex(const Primitive::Vertex &vertex) {
     color = vertex.color;
 }
 
-Primitive::GPUVertex::GPUVertex(const Primitive::GPUVertex &vertex) : Vertex(vertex) {
-    viewSpacePos = vertex.viewSpacePos;
-    enabled = vertex.enabled;
+size_t Primitive::VertexArrays::size() const {
+    return count;
+}
+
+size_t Primitive::VertexArrays::chunkCount() const {
+    return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// verts kept keep their attributes, the new ones and the padding after the last vert are zeros
+void Primitive::VertexArrays::resize(size_t count) {
+    this->count = count;
+    size_t paddedCount = chunkCount() * CHUNK_SIZE;
+    auto resizeAttribute = [count, paddedCount](auto &attribute) {
+        for (auto &component: attribute) {
+            component.resize(paddedCount);
+            std::fill(component.begin() + (long) count, component.end(), 0.f);
+        }
+    };
+    resizeAttribute(pos);
+    resizeAttribute(color);
+    resizeAttribute(uv);
+    resizeAttribute(normal);
+}
+
+/**
+ * the unique edges of the triangles of the mesh, so that an edge shared by two triangles is drawn once in line mode,
+ * loaded meshes keep a copy of a vertex for every face using it, so verts are matched by position instead of index
+ */
+const std::vector<Primitive::Mesh::Edge> &Primitive::Mesh::getEdges() {
+    if (!edgesDirty) return edges;
+    edges.clear();
+    edgesDirty = false;
+
+    // weld the verts at the same position
+    std::map<std::tuple<float, float, float>, uint> positionIds;
+    std::vector<uint> vertexIds(vertexes.size());
+    for (size_t i = 0; i < vertexes.size(); ++i) {
+        auto key = std::make_tuple(vertexes.pos[0][i], vertexes.pos[1][i], vertexes.pos[2][i]);
+        vertexIds[i] = positionIds.emplace(key, (uint) positionIds.size()).first->second;
+    }
+
+    std::map<std::pair<uint, uint>, int> edgeIndexes;
+    for (uint indexesI = 0; indexesI + 2 < indexes.size(); indexesI += 3) {
+        for (int i = 0; i < 3; ++i) {
+            uint index0 = indexes[indexesI + i], index1 = indexes[indexesI + (i + 1) % 3];
+            auto key = std::minmax(vertexIds[index0], vertexIds[index1]);
+            auto [it, inserted] = edgeIndexes.emplace(key, (int) edges.size());
+            if (inserted) {
+                edges.push_back({{indexesI, indexesI}, {{{index0, index1}, {index0, index1}}}});
+            } else if (edges[it->second].triangles[1] == edges[it->second].triangles[0]) {
+                edges[it->second].triangles[1] = indexesI;
+                edges[it->second].indexes[1] = {index0, index1};
+            }
+        }
+    }
+    return edges;
+}
+
+void Primitive::Mesh::invalidateEdges() {
+    edgesDirty = true;
 }
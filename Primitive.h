@@ -7,7 +7,9 @@
 
 #include <array>
 #include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/StdVector>
 #include <deque>
+#include <vector>
 #include <opencv2/core/hal/interface.h>
 #include <opencv2/core/mat.hpp>
 
@@ -30,10 +32,8 @@ namespace Primitive {
     class GPUVertex : public Vertex {
     public:
         Eigen::Vector4f viewSpacePos;
-        bool enabled = true;
 
         explicit GPUVertex(const Vertex &vertex);
-        GPUVertex(const GPUVertex &vertex);
 
         GPUVertex() = default;
     };
@@ -44,6 +44,8 @@ namespace Primitive {
         Eigen::Vector3f intensity;
     };
 
+    // copies of a texture share its image through the reference count of cv::Mat, the image is never written after it
+    // is loaded
     class Texture {
     private:
         cv::Mat image_data;
@@ -53,13 +55,11 @@ namespace Primitive {
 
         Texture() = default;
 
-        void copyTo(Texture &dest);
-
-        Eigen::Vector3f getValue(float u, float v);
+        Eigen::Vector3f getValue(float u, float v) const;
 
         void cleanData();
 
-        bool isEmpty();
+        bool isEmpty() const;
     };
 
     class Material {
@@ -71,10 +71,50 @@ namespace Primitive {
         Texture diffuseTexture;
     };
 
+    // the verts of a mesh in structure of arrays, component c of vert i is at pos[c][i], every array is aligned and
+    // padded with zeros to whole chunks of CHUNK_SIZE verts, so that the vertex stage runs over a chunk at a time
+    class VertexArrays {
+    public:
+        static constexpr int CHUNK_SIZE = 8;
+        typedef std::vector<float, Eigen::aligned_allocator<float>> Floats;
+
+        std::array<Floats, 4> pos;
+        std::array<Floats, 3> color;
+        std::array<Floats, 2> uv;
+        std::array<Floats, 3> normal;
+
+        size_t size() const;
+
+        size_t chunkCount() const;
+
+        void resize(size_t count);
+
+    private:
+        size_t count = 0;
+    };
+
     class Mesh {
     public:
-        std::deque<Vertex> vertexes;
-        std::deque<uint> indexes;
+        VertexArrays vertexes;
+        std::vector<uint> indexes;
+
+        // an edge shared by up to two triangles, triangles[k] is the index of the first vert of the k-th triangle in
+        // `indexes` and indexes[k] the indexes of the two verts of the edge in it, both are the same for a border edge
+        struct Edge {
+            std::array<uint, 2> triangles;
+            std::array<std::array<uint, 2>, 2> indexes;
+        };
+
+        const std::vector<Edge> &getEdges();
+
+        // call after writing `indexes` or the positions in `vertexes` of a mesh whose edges were already built
+        void invalidateEdges();
+
+    private:
+        // built from `indexes` by the first getEdges after the mesh is made or invalidateEdges is called,
+        // verts are welded by their positions at that time
+        std::vector<Edge> edges;
+        bool edgesDirty = true;
     };
 
     class Geometry {
@@ -2,15 +2,33 @@
 // Created by admin on 2022/9/23.
 //
 
+#include <algorithm>
 #include "Rasterizer.h"
 #include "ScreenBuffer.h"
 #include "Renderer.h"
 
-Rasterizer::Rasterizer(ScreenBuffer &screenBuffer, Primitive::Material &material,
+Rasterizer::Rasterizer(ScreenBuffer &screenBuffer, const Primitive::Material &material,
                        std::function<void(const Shader::FragmentShaderPayload &)> &fragmentShader) :
-        screenBuffer(screenBuffer), material(material), fragmentShader(fragmentShader) {}
+        screenBuffer(screenBuffer), material(material), fragmentShader(fragmentShader),
+        fragmentBatchShader(Shader::getFragmentBatchShader(fragmentShader)),
+        kernel(RasterizerKernel::getKernel()), scissor(screenBuffer.getRect()) {}
 
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
 void Rasterizer::rasterizeTriangle(const RasterizerPayload &payload) {
+    // the bounding box of the pixel centers, a triangle covering a few of them only tests them directly
+    TriangleSetup setup;
+    if (!setup.setup(payload.triangleVertexes, scissor)) return;
+    if (setup.maxX - setup.minX < SMALL_TRIANGLE_SIZE && setup.maxY - setup.minY < SMALL_TRIANGLE_SIZE) {
+        for (int y = setup.minY; y <= setup.maxY; ++y) {
+            for (int x = setup.minX; x <= setup.maxX; ++x) {
+                if (!checkInsideTriangle((float) x + 0.5f, (float) y + 0.5f, payload.triangleVertexes)) continue;
+                Eigen::Vector3f pointScreenSpacePos((float) x + 0.5f, (float) y + 0.5f, 0);
+                drawScreenSpacePoint<depthTest, depthWrite, varyingMask>(pointScreenSpacePos, payload);
+            }
+        }
+        return;
+    }
+
     std::vector<Eigen::Vector2f> scanTrianglePos;
     scanTrianglePos.reserve(3);
     for (auto item: payload.triangleVertexes) {
@@ -76,6 +94,10 @@ void Rasterizer::rasterizeTriangle(const RasterizerPayload &payload) {
             }
             if (startX < left) startX = left;
             if (endX > right) endX = right;
+            // only walk the pixels in the scissor rectangle, the triangle may lie in the guard band around the screen
+            if (y < scissor.y || y >= scissor.y + scissor.height) continue;
+            startX = MAX(startX, scissor.x);
+            endX = MIN(endX, scissor.x + scissor.width - 1);
             while (startX <= right &&
                    !checkInsideTriangle((float) startX + 0.5f, (float) y + 0.5f, payload.triangleVertexes))
                 ++startX;
@@ -84,58 +106,420 @@ void Rasterizer::rasterizeTriangle(const RasterizerPayload &payload) {
                 --endX;
             for (int x = startX; x <= endX; ++x) {
                 Eigen::Vector3f pointScreenSpacePos((float) x + 0.5f, (float) y + 0.5f, 0);
-                drawScreenSpacePoint(pointScreenSpacePos, payload);
+                drawScreenSpacePoint<depthTest, depthWrite, varyingMask>(pointScreenSpacePos, payload);
             }
         }
     }
 }
 
-void Rasterizer::rasterizeTriangleLine(const RasterizerPayload &payload) {
+/**
+ * rasterize triangle by stepping the three edge functions over its bounding box
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::rasterizeTriangleEdgeFunction(const RasterizerPayload &payload) {
+    TriangleSetup setup;
+    if (!setup.setup(payload.triangleVertexes, scissor)) return;
+    TriangleVaryings<varyingMask> varyings;
+    varyings.setup(setup, payload.triangleVertexes);
+    rasterizeTriangleSetup<depthTest, depthWrite, false>(setup, varyings, setup.edges, payload);
+}
+
+/**
+ * rasterize triangle snapped to 28.4 fixed point with the top-left fill rule, so that every pixel on an edge
+ * shared by two triangles is drawn exactly once
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::rasterizeTriangleFixedPoint(const RasterizerPayload &payload) {
+    TriangleSetup setup;
+    if (!setup.setupFixedPoint(payload.triangleVertexes, scissor)) return;
+    if (setup.maxX - setup.minX < SMALL_TRIANGLE_SIZE && setup.maxY - setup.minY < SMALL_TRIANGLE_SIZE) {
+        rasterizeSmallTriangle<depthTest, depthWrite, false, varyingMask>(setup, payload);
+        return;
+    }
+    TriangleVaryings<varyingMask> varyings;
+    varyings.setup(setup, payload.triangleVertexes);
+    if (setup.fixedEdgesFitInt32)
+        rasterizeTriangleBlocks<depthTest, depthWrite, false>(setup, varyings, payload);
+    else
+        rasterizeTriangleSetup<depthTest, depthWrite, false>(setup, varyings, setup.fixedEdges, payload);
+}
+
+/**
+ * rasterize triangle of homogeneous screen space verts by stepping its homogeneous edge functions, triangles
+ * crossing the plane of the eye are drawn without clipping, the near and far planes are left to the depth range test
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::rasterizeTriangleHomogeneous(const RasterizerPayload &payload) {
+    TriangleSetup setup;
+    if (!setup.setupHomogeneous(payload.triangleVertexes, scissor)) return;
+    TriangleVaryings<varyingMask> varyings;
+    varyings.setupHomogeneous(setup, payload.triangleVertexes);
+    rasterizeTriangleSetup<depthTest, depthWrite, false>(setup, varyings, setup.edges, payload);
+}
+
+/**
+ * same as rasterizeTriangleFixedPoint, but only test and write depth, the varyings are neither set up
+ * nor interpolated and no shader runs, used by the depth pre-pass
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite>
+void Rasterizer::rasterizeTriangleDepth(const RasterizerPayload &payload) {
+    TriangleSetup setup;
+    if (!setup.setupFixedPoint(payload.triangleVertexes, scissor)) return;
+    if (setup.maxX - setup.minX < SMALL_TRIANGLE_SIZE && setup.maxY - setup.minY < SMALL_TRIANGLE_SIZE) {
+        rasterizeSmallTriangle<depthTest, depthWrite, true, 0>(setup, payload);
+        return;
+    }
+    TriangleVaryings<0> noVaryings;
+    if (setup.fixedEdgesFitInt32)
+        rasterizeTriangleBlocks<depthTest, depthWrite, true>(setup, noVaryings, payload);
+    else
+        rasterizeTriangleSetup<depthTest, depthWrite, true>(setup, noVaryings, setup.fixedEdges, payload);
+}
+
+/**
+ * rasterize triangle into the multisample buffer, coverage and depth are evaluated at every sample of a pixel
+ * but the fragment shader runs once per pixel at its center, its color is written to the samples which passed
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::rasterizeTriangleMultisample(const RasterizerPayload &payload) {
+    static_assert(TriangleSetup::SUBPIXEL_STEP == 16, "sample offsets are in 1/16 pixel");
+    constexpr int SAMPLE_COUNT = ScreenBuffer::SAMPLE_COUNT;
+    constexpr int SAMPLE_MARGIN = 6;
+
+    TriangleSetup setup;
+    if (!setup.setupFixedPoint(payload.triangleVertexes, scissor, SAMPLE_MARGIN))
+        return;
+    TriangleVaryings<varyingMask> varyings;
+    varyings.setup(setup, payload.triangleVertexes);
+
+    // offsets of the edge functions and z at every sample from the pixel center, a fixed point edge steps
+    // SUBPIXEL_STEP times its 1/16 pixel slope per pixel, so the edge offsets are exact
+    std::array<std::array<int64_t, SAMPLE_COUNT>, 3> sampleEdgeOffsets{};
+    std::array<float, SAMPLE_COUNT> sampleZOffsets{};
+    for (int sample = 0; sample < SAMPLE_COUNT; ++sample) {
+        int offsetX = ScreenBuffer::SAMPLE_OFFSETS[sample][0], offsetY = ScreenBuffer::SAMPLE_OFFSETS[sample][1];
+        for (int i = 0; i < 3; ++i) {
+            sampleEdgeOffsets[i][sample] = (setup.fixedEdges[i].a * offsetX + setup.fixedEdges[i].b * offsetY)
+                                           / TriangleSetup::SUBPIXEL_STEP;
+        }
+        sampleZOffsets[sample] = (setup.z.a * (float) offsetX + setup.z.b * (float) offsetY)
+                                 / TriangleSetup::SUBPIXEL_STEP;
+    }
+
+    // blocks whose samples are all outside are skipped, those whose samples are all inside skip the edge tests
+    for (int y0 = setup.minY; y0 <= setup.maxY; y0 += BLOCK_SIZE) {
+        int y1 = MIN(y0 + BLOCK_SIZE - 1, setup.maxY);
+        for (int x0 = setup.minX; x0 <= setup.maxX; x0 += BLOCK_SIZE) {
+            int x1 = MIN(x0 + BLOCK_SIZE - 1, setup.maxX);
+            auto coverage = setup.classifyBlock(x0, y0, x1, y1, SAMPLE_MARGIN);
+            if (coverage == TriangleSetup::BLOCK_OUTSIDE) continue;
+
+            for (int y = y0; y <= y1; ++y) {
+                auto dy = (float) (y - setup.minY);
+                std::array<int64_t, 3> edge{};
+                for (int i = 0; i < 3; ++i) {
+                    edge[i] = setup.fixedEdges[i].c + setup.fixedEdges[i].a * (x0 - setup.minX)
+                              + setup.fixedEdges[i].b * (y - setup.minY);
+                }
+                for (int x = x0; x <= x1; ++x) {
+                    uint32_t coverageMask = ScreenBuffer::ALL_SAMPLES;
+                    if (coverage == TriangleSetup::BLOCK_PARTIAL) {
+                        coverageMask = 0;
+                        for (int sample = 0; sample < SAMPLE_COUNT; ++sample) {
+                            if (edge[0] + sampleEdgeOffsets[0][sample] >= 0 &&
+                                edge[1] + sampleEdgeOffsets[1][sample] >= 0 &&
+                                edge[2] + sampleEdgeOffsets[2][sample] >= 0)
+                                coverageMask |= 1u << sample;
+                        }
+                    }
+                    edge[0] += setup.fixedEdges[0].a;
+                    edge[1] += setup.fixedEdges[1].a;
+                    edge[2] += setup.fixedEdges[2].a;
+                    if (!coverageMask) continue;
+
+                    auto dx = (float) (x - setup.minX);
+                    coverageMask = testSampleDepth<depthTest, depthWrite>(x, y, setup.z.at(dx, dy), sampleZOffsets,
+                                                                          coverageMask);
+                    if (!coverageMask) continue;
+                    shadeFragment<varyingMask>(x, y, varyings.oneOverW.at(dx, dy), varyings.varyingsOverW.at(dx, dy),
+                                               payload, coverageMask);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * draw a fixed point triangle whose bounding box holds at most SMALL_TRIANGLE_SIZE * SMALL_TRIANGLE_SIZE pixel
+ * centers by testing them directly, the varyings are set up only if one of them is covered and passes the z test,
+ * the max depth of a tile is recalculated only if the depth overwritten was its max
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask>
+void Rasterizer::rasterizeSmallTriangle(const TriangleSetup &setup, const RasterizerPayload &payload) {
+    std::array<std::array<int, 2>, SMALL_TRIANGLE_SIZE * SMALL_TRIANGLE_SIZE> passedPixels{};
+    int passedCount = 0;
+    for (int y = setup.minY; y <= setup.maxY; ++y) {
+        for (int x = setup.minX; x <= setup.maxX; ++x) {
+            int dx = x - setup.minX, dy = y - setup.minY;
+            bool inside = true;
+            for (auto &edge: setup.fixedEdges) {
+                if (edge.c + edge.a * dx + edge.b * dy < 0) inside = false;
+            }
+            if (!inside) continue;
+
+            float z = setup.z.at((float) dx, (float) dy);
+            // clip out of range
+            if (z < 0 || z > 1) continue;
+            float &depth = screenBuffer.valueInDepthBuffer(x, y);
+            if (!passDepthTest<depthTest>(z, depth)) continue;
+            if constexpr (depthWrite) {
+                int tileX = x / ScreenBuffer::TILE_SIZE, tileY = y / ScreenBuffer::TILE_SIZE;
+                float &tileMaxDepth = screenBuffer.valueInTileMaxDepthBuffer(tileX, tileY);
+                float overwrittenDepth = depth;
+                depth = z;
+                if (z >= tileMaxDepth) tileMaxDepth = z;
+                else if (overwrittenDepth == tileMaxDepth) screenBuffer.updateTileMaxDepth(tileX, tileY);
+            }
+            passedPixels[passedCount++] = {x, y};
+        }
+    }
+
+    if constexpr (!depthOnly) {
+        if (passedCount == 0) return;
+        TriangleVaryings<varyingMask> varyings;
+        varyings.setup(setup, payload.triangleVertexes);
+        for (int i = 0; i < passedCount; ++i) {
+            auto [x, y] = passedPixels[i];
+            auto dx = (float) (x - setup.minX), dy = (float) (y - setup.minY);
+            shadeFragment<varyingMask>(x, y, varyings.oneOverW.at(dx, dy), varyings.varyingsOverW.at(dx, dy), payload);
+        }
+    }
+}
+
+/**
+ * rasterize a fixed point triangle hierarchically, COARSE_BLOCK_SIZE blocks then BLOCK_SIZE blocks are tested against
+ * the edges first, blocks outside the triangle are skipped and blocks inside it are drawn without coverage tests,
+ * BLOCK_SIZE blocks entirely behind the max depth of their tile in the hierarchical z buffer are skipped as well
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask>
+void Rasterizer::rasterizeTriangleBlocks(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings,
+                                         const RasterizerPayload &payload) {
+    for (int coarseY = setup.minY & ~(COARSE_BLOCK_SIZE - 1); coarseY <= setup.maxY; coarseY += COARSE_BLOCK_SIZE) {
+        for (int coarseX = setup.minX & ~(COARSE_BLOCK_SIZE - 1); coarseX <= setup.maxX; coarseX += COARSE_BLOCK_SIZE) {
+            int coarseX0 = MAX(coarseX, setup.minX), coarseX1 = MIN(coarseX + COARSE_BLOCK_SIZE - 1, setup.maxX);
+            int coarseY0 = MAX(coarseY, setup.minY), coarseY1 = MIN(coarseY + COARSE_BLOCK_SIZE - 1, setup.maxY);
+            auto coarseCoverage = setup.classifyBlock(coarseX0, coarseY0, coarseX1, coarseY1);
+            if (coarseCoverage == TriangleSetup::BLOCK_OUTSIDE) continue;
+
+            for (int y = coarseY; y <= coarseY1; y += BLOCK_SIZE) {
+                for (int x = coarseX; x <= coarseX1; x += BLOCK_SIZE) {
+                    int x0 = MAX(x, coarseX0), x1 = MIN(x + BLOCK_SIZE - 1, coarseX1);
+                    int y0 = MAX(y, coarseY0), y1 = MIN(y + BLOCK_SIZE - 1, coarseY1);
+                    auto coverage = coarseCoverage;
+                    if (coverage == TriangleSetup::BLOCK_PARTIAL) {
+                        coverage = setup.classifyBlock(x0, y0, x1, y1);
+                        if (coverage == TriangleSetup::BLOCK_OUTSIDE) continue;
+                    }
+
+                    // hierarchical z test
+                    int tileX = x / ScreenBuffer::TILE_SIZE, tileY = y / ScreenBuffer::TILE_SIZE;
+                    if constexpr (depthTest != RasterizerKernel::DEPTH_ALWAYS) {
+                        float tileMaxDepth = screenBuffer.valueInTileMaxDepthBuffer(tileX, tileY);
+                        float blockMinZ = setup.getBlockMinZ(x0, y0, x1, y1);
+                        if (depthTest == RasterizerKernel::DEPTH_LESS ? blockMinZ >= tileMaxDepth
+                                                                       : blockMinZ > tileMaxDepth)
+                            continue;
+                    }
+
+                    // without z test the written depth may also be larger, the max is recalculated either way
+                    bool inside = coverage == TriangleSetup::BLOCK_INSIDE;
+                    bool depthPassed = drawBlock<depthTest, depthWrite, depthOnly>(setup, varyings, x0, y0, x1, y1,
+                                                                                   inside, payload);
+                    if (depthPassed && depthWrite)
+                        screenBuffer.updateTileMaxDepth(tileX, tileY);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * draw block [x0, x1] * [y0, y1] of a fixed point triangle span by span with the simd kernel
+ * @param inside the block is known to be fully inside the triangle, so only z is tested
+ * @return any pixel in the block passed the z test or not
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask>
+bool Rasterizer::drawBlock(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings,
+                           int x0, int y0, int x1, int y1, bool inside, const RasterizerPayload &payload) {
+    constexpr int spanSize = RasterizerKernel::SPAN_SIZE;
+    std::array<int32_t, 3> edgeStep{};
     for (int i = 0; i < 3; ++i) {
-        Eigen::Vector2f p1(payload.triangleVertexes[i]->pos.x(),
-                           payload.triangleVertexes[i]->pos.y());
-        Eigen::Vector2f p2(payload.triangleVertexes[(i + 1) % 3]->pos.x(),
-                           payload.triangleVertexes[(i + 1) % 3]->pos.y());
-        float deltaY = p2.y() - p1.y();
-        float deltaX = p2.x() - p1.x();
-        bool isKLessThanOne = abs(deltaY) < abs(deltaX);
-
-        float ddx;
-        float ddy;
-        int steps;
-        Eigen::Vector2f p;
-
-        if (isKLessThanOne) {
-            if (p1.x() > p2.x()) {
-                std::swap(p1, p2);
-                deltaX = -deltaX;
-                deltaY = -deltaY;
+        edgeStep[i] = (int32_t) setup.fixedEdges[i].a;
+    }
+    float spanZ[spanSize];
+    bool depthPassed = false;
+
+    for (int y = y0; y <= y1; ++y) {
+        auto dy = (float) (y - setup.minY);
+        float *depthRow = &screenBuffer.valueInDepthBuffer(0, y);
+        for (int x = x0; x <= x1; x += spanSize) {
+            auto dx = (float) (x - setup.minX);
+            int count = MIN(spanSize, x1 - x + 1);
+            uint32_t mask;
+            if (inside) {
+                mask = kernel.depthSpan[depthTest](setup.z.at(dx, dy), setup.z.a, depthRow + x, count, spanZ);
+            } else {
+                std::array<int32_t, 3> edge{};
+                for (int i = 0; i < 3; ++i) {
+                    edge[i] = (int32_t) setup.fixedEdges[i].c + edgeStep[i] * (x - setup.minX)
+                              + (int32_t) setup.fixedEdges[i].b * (y - setup.minY);
+                }
+                mask = kernel.coverageSpan[depthTest](edge.data(), edgeStep.data(), setup.z.at(dx, dy), setup.z.a,
+                                                      depthRow + x, count, spanZ);
             }
-            ddx = 1;
-            ddy = deltaY / deltaX;
-            p.x() = round(p1.x()) + 0.5f;
-            p.y() = p1.y() + (p.x() - p1.x()) * ddy;
-            steps = (int) round(p2.x()) - (int) round(p1.x()) + 1;
-        } else {
-            if (p1.y() > p2.y()) {
-                std::swap(p1, p2);
-                deltaX = -deltaX;
-                deltaY = -deltaY;
+            if (!mask) continue;
+            depthPassed = true;
+
+            // z write
+            if constexpr (depthWrite) {
+                for (uint32_t i = 0, laneMask = mask; laneMask; ++i, laneMask >>= 1) {
+                    if (laneMask & 1) depthRow[x + i] = spanZ[i];
+                }
             }
-            ddy = 1;
-            ddx = deltaX / deltaY;
-            p.y() = round(p1.y()) + 0.5f;
-            p.x() = p1.x() + (p.y() - p1.y()) * ddx;
-            steps = (int) round(p2.y()) - (int) round(p1.y()) + 1;
+
+            if constexpr (!depthOnly) shadeSpan<varyingMask>(setup, varyings, x, y, mask, payload);
         }
+    }
+    return depthPassed;
+}
+
+/**
+ * step the edge functions over the bounding box of a set up triangle, along with z, 1/w and varyings/w
+ * @param edges float or fixed point edge functions, inside if all E_i >= 0
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask, typename T>
+void Rasterizer::rasterizeTriangleSetup(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings,
+                                        const std::array<PlaneEquation<T>, 3> &edges,
+                                        const RasterizerPayload &payload) {
+    typedef typename TriangleVaryings<varyingMask>::Varyings Varyings;
 
-        for (int step = 0; step < steps; ++step) {
-            Eigen::Vector3f pointScreenSpacePos(p.x(), p.y(), 0);
-            drawScreenSpacePoint(pointScreenSpacePos, payload);
+    // values at the center of the first pixel
+    std::array<T, 3> rowEdge{edges[0].c, edges[1].c, edges[2].c};
+    float rowZ = setup.z.c;
+    float rowOneOverW = varyings.oneOverW.c;
+    Varyings rowVaryingsOverW = varyings.varyingsOverW.c;
 
-            p.x() += ddx;
-            p.y() += ddy;
+    for (int y = setup.minY; y <= setup.maxY; ++y) {
+        std::array<T, 3> edge = rowEdge;
+        float z = rowZ;
+        float oneOverW = rowOneOverW;
+        Varyings varyingsOverW = rowVaryingsOverW;
+        for (int x = setup.minX; x <= setup.maxX; ++x) {
+            if (edge[0] >= 0 && edge[1] >= 0 && edge[2] >= 0 && testDepth<depthTest, depthWrite>(x, y, z)) {
+                if constexpr (!depthOnly) shadeFragment<varyingMask>(x, y, oneOverW, varyingsOverW, payload);
+            }
+            edge[0] += edges[0].a;
+            edge[1] += edges[1].a;
+            edge[2] += edges[2].a;
+            z += setup.z.a;
+            if constexpr (!depthOnly) {
+                oneOverW += varyings.oneOverW.a;
+                varyingsOverW += varyings.varyingsOverW.a;
+            }
         }
+        rowEdge[0] += edges[0].b;
+        rowEdge[1] += edges[1].b;
+        rowEdge[2] += edges[2].b;
+        rowZ += setup.z.b;
+        if constexpr (!depthOnly) {
+            rowOneOverW += varyings.oneOverW.b;
+            rowVaryingsOverW += varyings.varyingsOverW.b;
+        }
+    }
+}
+
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::rasterizeTriangleLine(const RasterizerPayload &payload) {
+    for (int i = 0; i < 3; ++i) {
+        rasterizeLine<depthTest, depthWrite, varyingMask>(*payload.triangleVertexes[i],
+                                                          *payload.triangleVertexes[(i + 1) % 3], payload);
+    }
+}
+
+/**
+ * draw a screen space line with an integer bresenham stepper, one pixel per step along the major axis,
+ * z, 1/w and varyings/w are stepped incrementally from v0 to v1 and varyings are divided per pixel
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::rasterizeLine(const Primitive::GPUVertex &v0, const Primitive::GPUVertex &v1,
+                               const RasterizerPayload &payload) {
+    typedef typename TriangleVaryings<varyingMask>::Varyings Varyings;
+
+    if (scissor.isEmpty()) return;
+
+    float oneOverW0 = 1.f / v0.pos.w(), oneOverW1 = 1.f / v1.pos.w();
+    Varyings varyingsOverW0, varyingsOverW1;
+    TriangleVaryings<varyingMask>::pack(v0, varyingsOverW0);
+    TriangleVaryings<varyingMask>::pack(v1, varyingsOverW1);
+    varyingsOverW0 *= oneOverW0;
+    varyingsOverW1 *= oneOverW1;
+
+    // clip the line to the scissor rectangle (liang-barsky), the verts of triangles in the guard band are off the
+    // screen, p * t <= q keeps the part of the line inside a border
+    float posX = v0.pos.x() - (float) scissor.x, posY = v0.pos.y() - (float) scissor.y;
+    float deltaPosX = v1.pos.x() - v0.pos.x(), deltaPosY = v1.pos.y() - v0.pos.y();
+    float t0 = 0, t1 = 1;
+    auto clipBorder = [&t0, &t1](float p, float q) {
+        if (p == 0) return q >= 0;
+        float t = q / p;
+        if (p < 0) t0 = MAX(t0, t);
+        else t1 = MIN(t1, t);
+        return t0 <= t1;
+    };
+    if (!clipBorder(-deltaPosX, posX) || !clipBorder(deltaPosX, (float) scissor.width - posX) ||
+        !clipBorder(-deltaPosY, posY) || !clipBorder(deltaPosY, (float) scissor.height - posY))
+        return;
+
+    // the pixels of the endpoints, clipped endpoints may lie exactly on the right or top border of the rectangle
+    int x0 = scissor.x + std::clamp((int) floor(posX + deltaPosX * t0), 0, scissor.width - 1);
+    int y0 = scissor.y + std::clamp((int) floor(posY + deltaPosY * t0), 0, scissor.height - 1);
+    int x1 = scissor.x + std::clamp((int) floor(posX + deltaPosX * t1), 0, scissor.width - 1);
+    int y1 = scissor.y + std::clamp((int) floor(posY + deltaPosY * t1), 0, scissor.height - 1);
+    int deltaX = abs(x1 - x0), deltaY = abs(y1 - y0);
+    int stepX = x0 < x1 ? 1 : -1, stepY = y0 < y1 ? 1 : -1;
+    int steps = std::max(deltaX, deltaY);
+
+    // every attribute is linear along the line in screen space
+    float z = v0.pos.z() + (v1.pos.z() - v0.pos.z()) * t0, oneOverW = oneOverW0 + (oneOverW1 - oneOverW0) * t0;
+    Varyings varyingsOverW = varyingsOverW0 + (varyingsOverW1 - varyingsOverW0) * t0;
+    float invSteps = steps > 0 ? (t1 - t0) / (float) steps : 0.f;
+    float dz = (v1.pos.z() - v0.pos.z()) * invSteps, dOneOverW = (oneOverW1 - oneOverW0) * invSteps;
+    Varyings dVaryingsOverW = (varyingsOverW1 - varyingsOverW0) * invSteps;
+
+    bool multisample = screenBuffer.hasMultisampleBuffer();
+    int x = x0, y = y0;
+    int error = deltaX - deltaY;
+    for (int step = 0; step <= steps; ++step) {
+        if (multisample) {
+            // a line covers every sample of its pixels
+            uint32_t sampleMask = testSampleDepth<depthTest, depthWrite>(x, y, z, {}, ScreenBuffer::ALL_SAMPLES);
+            if (sampleMask) shadeFragment<varyingMask>(x, y, oneOverW, varyingsOverW, payload, sampleMask);
+        } else if (testDepth<depthTest, depthWrite>(x, y, z)) {
+            shadeFragment<varyingMask>(x, y, oneOverW, varyingsOverW, payload);
+        }
+
+        int error2 = 2 * error;
+        if (error2 > -deltaY) {
+            error -= deltaY;
+            x += stepX;
+        }
+        if (error2 < deltaX) {
+            error += deltaX;
+            y += stepY;
+        }
+        z += dz;
+        oneOverW += dOneOverW;
+        varyingsOverW += dVaryingsOverW;
     }
 }
 
@@ -187,12 +571,15 @@ Rasterizer::convertBarycentricCoordinates(float screenSpaceAlpha, float screenSp
     return {viewSpaceAlpha, viewSpaceBeta, viewSpaceGamma};
 }
 
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
 void Rasterizer::drawScreenSpacePoint(Eigen::Vector3f &pointScreenSpacePos, const RasterizerPayload &payload) {
     int pixelX = floor(pointScreenSpacePos.x());
     int pixelY = floor(pointScreenSpacePos.y());
 
-    // clip out of range
-    if (pixelX < 0 || pixelX >= screenBuffer.width || pixelY < 0 || pixelY >= screenBuffer.height) return;
+    // clip out of the scissor rectangle
+    if (pixelX < scissor.x || pixelX >= scissor.x + scissor.width || pixelY < scissor.y ||
+        pixelY >= scissor.y + scissor.height)
+        return;
 
     // calc barycentric coordinates in screen space
     auto [screenSpaceAlpha, screenSpaceBeta, screenSpaceGamma]
@@ -202,17 +589,24 @@ void Rasterizer::drawScreenSpacePoint(Eigen::Vector3f &pointScreenSpacePos, cons
     // ignore point in a 'dot' triangle
     if (_isnanf(screenSpaceAlpha) || _isnanf(screenSpaceGamma) || _isnanf(screenSpaceBeta)) return;
 
+    drawScreenSpacePoint<depthTest, depthWrite, varyingMask>(pixelX, pixelY, screenSpaceAlpha, screenSpaceBeta,
+                                                             screenSpaceGamma, payload);
+}
+
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Rasterizer::drawScreenSpacePoint(int pixelX, int pixelY, float screenSpaceAlpha, float screenSpaceBeta,
+                                      float screenSpaceGamma, const RasterizerPayload &payload) {
     // interpolate z
-    pointScreenSpacePos.z() = screenSpaceAlpha * payload.triangleVertexes[0]->pos.z()
-                              + screenSpaceBeta * payload.triangleVertexes[1]->pos.z()
-                              + screenSpaceGamma * payload.triangleVertexes[2]->pos.z();
+    float z = screenSpaceAlpha * payload.triangleVertexes[0]->pos.z()
+              + screenSpaceBeta * payload.triangleVertexes[1]->pos.z()
+              + screenSpaceGamma * payload.triangleVertexes[2]->pos.z();
 
     // clip out of range
-    if (pointScreenSpacePos.z() < 0 || pointScreenSpacePos.z() > 1) return;
+    if (z < 0 || z > 1) return;
 
     // z test
-    if (pointScreenSpacePos.z() >= screenBuffer.valueInDepthBuffer(pixelX, pixelY))
-        return;
+    float &depth = screenBuffer.valueInDepthBuffer(pixelX, pixelY);
+    if (!passDepthTest<depthTest>(z, depth)) return;
 
     // convert barycentric coordinates from screen space to view space
     auto [viewSpaceAlpha, viewSpaceBeta, viewSpaceGamma]
@@ -223,21 +617,194 @@ void Rasterizer::drawScreenSpacePoint(Eigen::Vector3f &pointScreenSpacePos, cons
     if (_isnanf(viewSpaceAlpha) || _isnanf(viewSpaceGamma) || _isnanf(viewSpaceBeta)) return;
 
     // z write
-    screenBuffer.valueInDepthBuffer(pixelX, pixelY) = pointScreenSpacePos.z();
-
-    // interpolate other
-    Eigen::Vector3f color = viewSpaceAlpha * payload.triangleVertexes[0]->color
-                            + viewSpaceBeta * payload.triangleVertexes[1]->color
-                            + viewSpaceGamma * payload.triangleVertexes[2]->color;
-    Eigen::Vector3f normal = (viewSpaceAlpha * payload.triangleVertexes[0]->normal
-                              + viewSpaceBeta * payload.triangleVertexes[1]->normal
-                              + viewSpaceGamma * payload.triangleVertexes[2]->normal).normalized();
-    Eigen::Vector2f uv = viewSpaceAlpha * payload.triangleVertexes[0]->uv
-                         + viewSpaceBeta * payload.triangleVertexes[1]->uv
-                         + viewSpaceGamma * payload.triangleVertexes[2]->uv;
-    Eigen::Vector3f viewSpacePos = viewSpaceAlpha * payload.triangleVertexes[0]->viewSpacePos.head(3)
-                                   + viewSpaceBeta * payload.triangleVertexes[1]->viewSpacePos.head(3)
-                                   + viewSpaceGamma * payload.triangleVertexes[2]->viewSpacePos.head(3);
+    if constexpr (depthWrite) writeDepth<depthTest>(pixelX, pixelY, depth, z);
+
+    // interpolate other, only the varyings read by the fragment shader
+    Eigen::Vector3f color = Eigen::Vector3f::Zero(), normal = Eigen::Vector3f::Zero();
+    Eigen::Vector3f viewSpacePos = Eigen::Vector3f::Zero();
+    Eigen::Vector2f uv = Eigen::Vector2f::Zero();
+    if constexpr ((bool) (varyingMask & Shader::VARYING_COLOR))
+        color = viewSpaceAlpha * payload.triangleVertexes[0]->color
+                + viewSpaceBeta * payload.triangleVertexes[1]->color
+                + viewSpaceGamma * payload.triangleVertexes[2]->color;
+    if constexpr ((bool) (varyingMask & Shader::VARYING_NORMAL))
+        normal = (viewSpaceAlpha * payload.triangleVertexes[0]->normal
+                  + viewSpaceBeta * payload.triangleVertexes[1]->normal
+                  + viewSpaceGamma * payload.triangleVertexes[2]->normal).normalized();
+    if constexpr ((bool) (varyingMask & Shader::VARYING_UV))
+        uv = viewSpaceAlpha * payload.triangleVertexes[0]->uv
+             + viewSpaceBeta * payload.triangleVertexes[1]->uv
+             + viewSpaceGamma * payload.triangleVertexes[2]->uv;
+    if constexpr ((bool) (varyingMask & Shader::VARYING_VIEW_SPACE_POS))
+        viewSpacePos = viewSpaceAlpha * payload.triangleVertexes[0]->viewSpacePos.head(3)
+                       + viewSpaceBeta * payload.triangleVertexes[1]->viewSpacePos.head(3)
+                       + viewSpaceGamma * payload.triangleVertexes[2]->viewSpacePos.head(3);
+
+    writeFragment<varyingMask>(pixelX, pixelY, viewSpacePos, color, normal, uv, payload);
+}
+
+/**
+ * test and write z of a pixel covered by a set up triangle, by the depth test and depth write of the rasterizer
+ * @return the pixel passed the z test or not
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite>
+bool Rasterizer::testDepth(int pixelX, int pixelY, float z) {
+    // clip out of range
+    if (z < 0 || z > 1) return false;
+
+    // z test
+    float &depth = screenBuffer.valueInDepthBuffer(pixelX, pixelY);
+    if (!passDepthTest<depthTest>(z, depth)) return false;
+
+    // z write
+    if constexpr (depthWrite) writeDepth<depthTest>(pixelX, pixelY, depth, z);
+    return true;
+}
+
+/**
+ * test and write z of the samples of a pixel in the multisample buffer
+ * @param zOffsets z of every sample relative to z at the pixel center
+ * @param coverageMask bit i is set if sample i is covered
+ * @return the covered samples which passed the z test
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite>
+uint32_t Rasterizer::testSampleDepth(int pixelX, int pixelY, float z,
+                                     const std::array<float, ScreenBuffer::SAMPLE_COUNT> &zOffsets,
+                                     uint32_t coverageMask) {
+    float *depths = screenBuffer.samplesInDepthBuffer(pixelX, pixelY);
+    uint32_t passedMask = 0;
+    for (int sample = 0; sample < ScreenBuffer::SAMPLE_COUNT; ++sample) {
+        float sampleZ = z + zOffsets[sample];
+        // clip out of range
+        if (!(coverageMask & (1u << sample)) || sampleZ < 0 || sampleZ > 1) continue;
+        if (!passDepthTest<depthTest>(sampleZ, depths[sample])) continue;
+        if constexpr (depthWrite) depths[sample] = sampleZ;
+        passedMask |= 1u << sample;
+    }
+    return passedMask;
+}
+
+/**
+ * write z of a pixel which passed the z test, z only exceeds the depth it overwrites without z test,
+ * then the max depth of its tile is raised to keep it an upper bound for the hierarchical z test
+ * @param depth the depth of the pixel in the depth buffer
+ */
+template<RasterizerKernel::DepthTest depthTest>
+void Rasterizer::writeDepth(int pixelX, int pixelY, float &depth, float z) {
+    depth = z;
+    if constexpr (depthTest == RasterizerKernel::DEPTH_ALWAYS) {
+        float &tileMaxDepth = screenBuffer.valueInTileMaxDepthBuffer(pixelX / ScreenBuffer::TILE_SIZE,
+                                                                     pixelY / ScreenBuffer::TILE_SIZE);
+        if (z > tileMaxDepth) tileMaxDepth = z;
+    }
+}
+
+template<RasterizerKernel::DepthTest depthTest>
+bool Rasterizer::passDepthTest(float z, float depth) {
+    if constexpr (depthTest == RasterizerKernel::DEPTH_LESS) return z < depth;
+    else if constexpr (depthTest == RasterizerKernel::DEPTH_LESS_EQUAL) return z <= depth;
+    else return true;
+}
+
+/**
+ * recover the perspective correct varyings of the pixels in a span of a set up triangle in structure of arrays and
+ * apply the batch fragment shader once to those which passed the z test, deferred geometries store every pixel in
+ * the g-buffer instead
+ * @param coverageMask bit i is set if pixel x + i passed the z test
+ */
+template<uint32_t varyingMask>
+void Rasterizer::shadeSpan(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings, int x, int y,
+                           uint32_t coverageMask, const RasterizerPayload &payload) {
+    typedef TriangleVaryings<varyingMask> Layout;
+    constexpr int batchSize = Shader::FRAGMENT_BATCH_SIZE;
+    static_assert(batchSize == RasterizerKernel::SPAN_SIZE, "a batch is a span");
+    auto dx = (float) (x - setup.minX), dy = (float) (y - setup.minY);
+
+    if (deferredMaterialId >= 0) {
+        for (int i = 0; coverageMask; ++i, coverageMask >>= 1) {
+            if (!(coverageMask & 1)) continue;
+            shadeFragment<varyingMask>(x + i, y, varyings.oneOverW.at(dx + (float) i, dy),
+                                       varyings.varyingsOverW.at(dx + (float) i, dy), payload);
+        }
+        return;
+    }
+
+    float w[batchSize];
+    for (int i = 0; i < batchSize; ++i) w[i] = 1.f / varyings.oneOverW.at(dx + (float) i, dy);
+    auto interpolate = [&](float (*out)[batchSize], int offset, int size) {
+        auto &plane = varyings.varyingsOverW;
+        for (int c = 0; c < size; ++c) {
+            for (int i = 0; i < batchSize; ++i) {
+                out[c][i] = (plane.a[offset + c] * (dx + (float) i) + plane.b[offset + c] * dy + plane.c[offset + c])
+                            * w[i];
+            }
+        }
+    };
+
+    Shader::FragmentBatch fragments{};
+    fragments.coverageMask = coverageMask;
+    if constexpr (Layout::HAS_VIEW_SPACE_POS)
+        interpolate(fragments.viewSpacePos, Layout::VIEW_SPACE_POS_OFFSET, 3);
+    if constexpr (Layout::HAS_COLOR) interpolate(fragments.color, Layout::COLOR_OFFSET, 3);
+    if constexpr (Layout::HAS_UV) interpolate(fragments.uv, Layout::UV_OFFSET, 2);
+    if constexpr (Layout::HAS_NORMAL) {
+        auto &normal = fragments.normal;
+        interpolate(normal, Layout::NORMAL_OFFSET, 3);
+        for (int i = 0; i < batchSize; ++i) {
+            float squaredNorm = normal[0][i] * normal[0][i] + normal[1][i] * normal[1][i] + normal[2][i] * normal[2][i];
+            if (squaredNorm <= 0) continue;
+            float norm = std::sqrt(squaredNorm);
+            for (auto &component: normal) component[i] /= norm;
+        }
+    }
+
+    // apply fragment shader
+    Shader::FragmentBatchShaderPayload fragmentBatchShaderPayload{fragments, payload.lightList, material};
+    Shader::basicFragmentBatchShader(fragmentBatchShaderPayload);
+    fragmentBatchShader(fragmentBatchShaderPayload);
+
+    Eigen::Vector3f *frameRow = &screenBuffer.valueInFrameBuffer(x, y);
+    for (int i = 0; coverageMask; ++i, coverageMask >>= 1) {
+        if (!(coverageMask & 1)) continue;
+        frameRow[i] = {fragments.color[0][i], fragments.color[1][i], fragments.color[2][i]};
+        // a pixel covered by a forward geometry must not be lit again by the deferred lighting pass
+        if (screenBuffer.hasGBuffer()) screenBuffer.valueInMaterialIdBuffer(x + i, y) = -1;
+    }
+}
+
+/**
+ * recover the perspective correct varyings of a pixel which passed the z test and apply the fragment shader
+ */
+template<uint32_t varyingMask>
+void Rasterizer::shadeFragment(int pixelX, int pixelY, float oneOverW,
+                               const typename TriangleVaryings<varyingMask>::Varyings &varyingsOverW,
+                               const RasterizerPayload &payload, uint32_t sampleMask) {
+    Eigen::Vector3f viewSpacePos, color, normal;
+    Eigen::Vector2f uv;
+    TriangleVaryings<varyingMask>::unpack(varyingsOverW * (1.f / oneOverW), viewSpacePos, color, normal, uv);
+
+    writeFragment<varyingMask>(pixelX, pixelY, viewSpacePos, color, normal, uv, payload, sampleMask);
+}
+
+/**
+ * apply the fragment shader and write the frame buffer, or only store the varyings in the g-buffer when the geometry is
+ * shaded deferred, Renderer::shadeDeferred will apply the fragment shader once for every pixel after all are drawn
+ */
+template<uint32_t varyingMask>
+void Rasterizer::writeFragment(int pixelX, int pixelY, Eigen::Vector3f &viewSpacePos, Eigen::Vector3f &color,
+                               Eigen::Vector3f &normal, Eigen::Vector2f &uv, const RasterizerPayload &payload,
+                               uint32_t sampleMask) {
+    if (deferredMaterialId >= 0) {
+        // the material only reads the varyings in the mask, the others are left as they are
+        int index = screenBuffer.getIndex(pixelX, pixelY);
+        if constexpr ((bool) (varyingMask & Shader::VARYING_VIEW_SPACE_POS))
+            screenBuffer.viewSpacePosBuffer[index] = viewSpacePos;
+        if constexpr ((bool) (varyingMask & Shader::VARYING_COLOR)) screenBuffer.colorBuffer[index] = color;
+        if constexpr ((bool) (varyingMask & Shader::VARYING_NORMAL)) screenBuffer.normalBuffer[index] = normal;
+        if constexpr ((bool) (varyingMask & Shader::VARYING_UV)) screenBuffer.uvBuffer[index] = uv;
+        screenBuffer.materialIdBuffer[index] = deferredMaterialId;
+        return;
+    }
 
     // apply fragment shader
     Shader::FragmentShaderPayload fragmentShaderPayload{viewSpacePos, color, normal, uv,
@@ -246,5 +813,43 @@ void Rasterizer::drawScreenSpacePoint(Eigen::Vector3f &pointScreenSpacePos, cons
     Shader::basicFragmentShader(fragmentShaderPayload);
     fragmentShader(fragmentShaderPayload);
 
+    if (screenBuffer.hasMultisampleBuffer()) {
+        // the samples are averaged into the frame buffer by ScreenBuffer::resolveMultisample
+        Eigen::Vector3f *colors = screenBuffer.samplesInColorBuffer(pixelX, pixelY);
+        for (int sample = 0; sample < ScreenBuffer::SAMPLE_COUNT; ++sample) {
+            if (sampleMask & (1u << sample)) colors[sample] = fragmentShaderPayload.color;
+        }
+        return;
+    }
     screenBuffer.valueInFrameBuffer(pixelX, pixelY) = fragmentShaderPayload.color;
+    // a pixel covered by a forward geometry must not be lit again by the deferred lighting pass
+    if (screenBuffer.hasGBuffer()) screenBuffer.valueInMaterialIdBuffer(pixelX, pixelY) = -1;
 }
+
+// instantiate the rasterization entries for every depth state and varying mask used by Renderer::rasterizeTriangles
+#define INSTANTIATE_RASTERIZER_VARYINGS(depthTest, depthWrite, varyingMask) \
+    template void Rasterizer::rasterizeTriangle<depthTest, depthWrite, varyingMask>(const RasterizerPayload &); \
+    template void Rasterizer::rasterizeTriangleEdgeFunction<depthTest, depthWrite, varyingMask>( \
+            const RasterizerPayload &); \
+    template void Rasterizer::rasterizeTriangleFixedPoint<depthTest, depthWrite, varyingMask>( \
+            const RasterizerPayload &); \
+    template void Rasterizer::rasterizeTriangleMultisample<depthTest, depthWrite, varyingMask>( \
+            const RasterizerPayload &); \
+    template void Rasterizer::rasterizeTriangleHomogeneous<depthTest, depthWrite, varyingMask>( \
+            const RasterizerPayload &); \
+    template void Rasterizer::rasterizeTriangleLine<depthTest, depthWrite, varyingMask>(const RasterizerPayload &); \
+    template void Rasterizer::rasterizeLine<depthTest, depthWrite, varyingMask>( \
+            const Primitive::GPUVertex &, const Primitive::GPUVertex &, const RasterizerPayload &);
+
+#define INSTANTIATE_RASTERIZER(depthTest, depthWrite) \
+    template void Rasterizer::rasterizeTriangleDepth<depthTest, depthWrite>(const RasterizerPayload &); \
+    INSTANTIATE_RASTERIZER_VARYINGS(depthTest, depthWrite, Shader::VARYING_COLOR) \
+    INSTANTIATE_RASTERIZER_VARYINGS(depthTest, depthWrite, Shader::VARYING_UV) \
+    INSTANTIATE_RASTERIZER_VARYINGS(depthTest, depthWrite, Shader::VARYING_ALL)
+
+INSTANTIATE_RASTERIZER(RasterizerKernel::DEPTH_LESS, false)
+INSTANTIATE_RASTERIZER(RasterizerKernel::DEPTH_LESS, true)
+INSTANTIATE_RASTERIZER(RasterizerKernel::DEPTH_LESS_EQUAL, false)
+INSTANTIATE_RASTERIZER(RasterizerKernel::DEPTH_LESS_EQUAL, true)
+INSTANTIATE_RASTERIZER(RasterizerKernel::DEPTH_ALWAYS, false)
+INSTANTIATE_RASTERIZER(RasterizerKernel::DEPTH_ALWAYS, true)
@@ -8,8 +8,9 @@
 #include <array>
 #include "Primitive.h"
 #include "Shader.h"
-
-class ScreenBuffer;
+#include "TriangleSetup.h"
+#include "RasterizerKernel.h"
+#include "ScreenBuffer.h"
 
 struct RasterizerPayload {
     std::array<Primitive::GPUVertex *, 3> &triangleVertexes;
@@ -18,14 +19,55 @@ struct RasterizerPayload {
 
 class Rasterizer {
 public:
-    Rasterizer(ScreenBuffer &screenBuffer, Primitive::Material &material,
+    // blocks tested against the edges before any pixel in them, aligned to the screen,
+    // a block is exactly a tile of the hierarchical z buffer
+    static constexpr int BLOCK_SIZE = ScreenBuffer::TILE_SIZE;
+    static constexpr int COARSE_BLOCK_SIZE = 64;
+    // triangles whose bounding box holds at most SMALL_TRIANGLE_SIZE * SMALL_TRIANGLE_SIZE pixel centers
+    // skip the span setup and test them directly
+    static constexpr int SMALL_TRIANGLE_SIZE = 2;
+
+    Rasterizer(ScreenBuffer &screenBuffer, const Primitive::Material &material,
                std::function<void(const Shader::FragmentShaderPayload &)> &fragmentShader);
 
     ScreenBuffer &screenBuffer;
-    Primitive::Material &material;
+    const Primitive::Material &material;
     std::function<void(const Shader::FragmentShaderPayload &)> &fragmentShader;
+    // shades the spans of the block rasterizer, the batch version of fragmentShader
+    Shader::FragmentBatchShader fragmentBatchShader;
+    const RasterizerKernel::Kernel &kernel;
+    // no pixel outside it is drawn, the whole screen buffer by default
+    ScreenRect scissor;
+    // index of the material in Renderer::deferredMaterials when the geometry is shaded deferred, -1 if forward
+    int deferredMaterialId = -1;
+
+    // every rasterization entry is compiled once per depth state and per mask of the varyings the fragment shader
+    // reads (Shader::Varying), so that the z test, z write and unused varyings are resolved at compile time
+    // instead of per pixel, see Renderer::rasterizeTriangles
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeTriangle(const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeTriangleEdgeFunction(const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeTriangleFixedPoint(const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite>
+    void rasterizeTriangleDepth(const RasterizerPayload &payload);
 
-    virtual void rasterizeTriangle(const RasterizerPayload &payload);
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeTriangleMultisample(const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeTriangleHomogeneous(const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeTriangleLine(const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeLine(const Primitive::GPUVertex &v0, const Primitive::GPUVertex &v1,
+                       const RasterizerPayload &payload);
 
     static bool checkInsideTriangle(float posX, float posY, std::array<Primitive::GPUVertex *, 3> &triangleVertexes);
 
@@ -36,9 +78,54 @@ public:
     convertBarycentricCoordinates(float screenSpaceAlpha, float screenSpaceBeta, float screenSpaceGamma,
                                   std::array<Primitive::GPUVertex *, 3> &triangleVertexes);
 
-    void rasterizeTriangleLine(const RasterizerPayload &payload);
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask>
+    void rasterizeTriangleBlocks(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings,
+                                 const RasterizerPayload &payload);
 
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask>
+    void rasterizeSmallTriangle(const TriangleSetup &setup, const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask>
+    bool drawBlock(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings,
+                   int x0, int y0, int x1, int y1, bool inside, const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, bool depthOnly, uint32_t varyingMask, typename T>
+    void rasterizeTriangleSetup(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings,
+                                const std::array<PlaneEquation<T>, 3> &edges, const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
     void drawScreenSpacePoint(Eigen::Vector3f &pointScreenSpacePos, const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void drawScreenSpacePoint(int pixelX, int pixelY, float screenSpaceAlpha, float screenSpaceBeta,
+                              float screenSpaceGamma, const RasterizerPayload &payload);
+
+    template<RasterizerKernel::DepthTest depthTest>
+    static bool passDepthTest(float z, float depth);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite>
+    bool testDepth(int pixelX, int pixelY, float z);
+
+    template<RasterizerKernel::DepthTest depthTest>
+    void writeDepth(int pixelX, int pixelY, float &depth, float z);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite>
+    uint32_t testSampleDepth(int pixelX, int pixelY, float z,
+                             const std::array<float, ScreenBuffer::SAMPLE_COUNT> &zOffsets, uint32_t coverageMask);
+
+    template<uint32_t varyingMask>
+    void shadeSpan(const TriangleSetup &setup, const TriangleVaryings<varyingMask> &varyings, int x, int y,
+                   uint32_t coverageMask, const RasterizerPayload &payload);
+
+    template<uint32_t varyingMask>
+    void shadeFragment(int pixelX, int pixelY, float oneOverW,
+                       const typename TriangleVaryings<varyingMask>::Varyings &varyingsOverW,
+                       const RasterizerPayload &payload, uint32_t sampleMask = ScreenBuffer::ALL_SAMPLES);
+
+    template<uint32_t varyingMask>
+    void writeFragment(int pixelX, int pixelY, Eigen::Vector3f &viewSpacePos, Eigen::Vector3f &color,
+                       Eigen::Vector3f &normal, Eigen::Vector2f &uv, const RasterizerPayload &payload,
+                       uint32_t sampleMask = ScreenBuffer::ALL_SAMPLES);
 };
 
 
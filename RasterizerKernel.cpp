@@ -0,0 +1,677 @@
+//
+// Created by .torrent on 2026/10/17.
+//
+
+#include "RasterizerKernel.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RASTERIZER_KERNEL_X86
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// msvc compiles any intrinsic without extra flags, gcc and clang need the target enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define RASTERIZER_KERNEL_TARGET(instructionSets)
+#else
+#define RASTERIZER_KERNEL_TARGET(instructionSets) __attribute__((target(instructionSets)))
+#endif
+
+namespace RasterizerKernel {
+    template<DepthTest depthTest>
+    static bool depthTestPass(float z, float depth) {
+        if constexpr (depthTest == DEPTH_LESS) return z < depth;
+        else if constexpr (depthTest == DEPTH_LESS_EQUAL) return z <= depth;
+        else return true;
+    }
+
+    template<DepthTest depthTest>
+    static uint32_t coverageSpanScalar(const int32_t *edge, const int32_t *edgeStep, float z, float zStep,
+                                       const float *depth, int count, float *zOut) {
+        uint32_t mask = 0;
+        for (int i = 0; i < count; ++i) {
+            int32_t edge0 = edge[0] + i * edgeStep[0];
+            int32_t edge1 = edge[1] + i * edgeStep[1];
+            int32_t edge2 = edge[2] + i * edgeStep[2];
+            float pixelZ = z + (float) i * zStep;
+            zOut[i] = pixelZ;
+            if ((edge0 | edge1 | edge2) >= 0 && pixelZ >= 0 && pixelZ <= 1 && depthTestPass<depthTest>(pixelZ, depth[i]))
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+
+    template<DepthTest depthTest>
+    static uint32_t depthSpanScalar(float z, float zStep, const float *depth, int count, float *zOut) {
+        uint32_t mask = 0;
+        for (int i = 0; i < count; ++i) {
+            float pixelZ = z + (float) i * zStep;
+            zOut[i] = pixelZ;
+            if (pixelZ >= 0 && pixelZ <= 1 && depthTestPass<depthTest>(pixelZ, depth[i]))
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+
+    static void transformVertexChunkScalar(const VertexTransform &transform, const float *const *pos,
+                                           const float *const *normal, VertexChunk &chunk) {
+        const float *modelView = transform.modelView, *projection = transform.projection;
+        const float *normalMatrix = transform.normal;
+        for (int i = 0; i < VERTEX_CHUNK_SIZE; ++i) {
+            for (int r = 0; r < 4; ++r) {
+                chunk.viewSpacePos[r][i] = modelView[r] * pos[0][i] + modelView[4 + r] * pos[1][i] +
+                                           modelView[8 + r] * pos[2][i] + modelView[12 + r] * pos[3][i];
+            }
+            for (int r = 0; r < 4; ++r) {
+                chunk.clipPos[r][i] = projection[r] * chunk.viewSpacePos[0][i] +
+                                      projection[4 + r] * chunk.viewSpacePos[1][i] +
+                                      projection[8 + r] * chunk.viewSpacePos[2][i] +
+                                      projection[12 + r] * chunk.viewSpacePos[3][i];
+            }
+
+            // zero normals are left as they are
+            float squaredNorm = normal[0][i] * normal[0][i] + normal[1][i] * normal[1][i] + normal[2][i] * normal[2][i];
+            float norm = squaredNorm > 0 ? std::sqrt(squaredNorm) : 1.f;
+            float unitNormal[3] = {normal[0][i] / norm, normal[1][i] / norm, normal[2][i] / norm};
+            for (int r = 0; r < 3; ++r) {
+                chunk.normal[r][i] = normalMatrix[r] * unitNormal[0] + normalMatrix[3 + r] * unitNormal[1] +
+                                     normalMatrix[6 + r] * unitNormal[2];
+            }
+
+            float x = chunk.clipPos[0][i], y = chunk.clipPos[1][i], z = chunk.clipPos[2][i], w = chunk.clipPos[3][i];
+            if (!transform.homogeneous) {
+                x = x / w, y = y / w, z = z / w;
+                w = 1;
+            }
+            chunk.screenPos[0][i] = transform.viewportX * w + 0.5f * transform.viewportWidth * (x + w);
+            chunk.screenPos[1][i] = transform.viewportY * w + 0.5f * transform.viewportHeight * (y + w);
+            chunk.screenPos[2][i] = (z + w) * 0.5f;
+            chunk.screenPos[3][i] = chunk.clipPos[3][i];
+            chunk.outcode[i] = getOutcode(chunk.clipPos[0][i], chunk.clipPos[1][i], chunk.clipPos[2][i],
+                                          chunk.clipPos[3][i]);
+        }
+    }
+
+    static uint32_t cullTriangleChunkScalar(const TriangleChunk &chunk, uint32_t facings, float subpixelStep) {
+        auto &p0 = chunk.viewSpacePos[0], &p1 = chunk.viewSpacePos[1], &p2 = chunk.viewSpacePos[2];
+        auto &s = chunk.screenPos;
+        uint32_t mask = 0;
+        for (int i = 0; i < TRIANGLE_CHUNK_SIZE; ++i) {
+            float edge1[3] = {p1[0][i] - p0[0][i], p1[1][i] - p0[1][i], p1[2][i] - p0[2][i]};
+            float edge2[3] = {p2[0][i] - p0[0][i], p2[1][i] - p0[1][i], p2[2][i] - p0[2][i]};
+            float normal[3] = {edge1[1] * edge2[2] - edge1[2] * edge2[1], edge1[2] * edge2[0] - edge1[0] * edge2[2],
+                               edge1[0] * edge2[1] - edge1[1] * edge2[0]};
+            float facing = normal[0] * p0[0][i] + normal[1] * p0[1][i] + normal[2] * p0[2][i];
+            uint32_t facingBit = facing > 0 ? FACING_FRONT : facing < 0 ? FACING_BACK : FACING_EDGE_ON;
+            uint32_t outside = chunk.outcode[0][i] & chunk.outcode[1][i] & chunk.outcode[2][i] & OUTCODE_FRUSTUM;
+            if (!(facingBit & facings) || outside) continue;
+
+            // rounded half away from zero like llround, the differences fit in float and their products in double
+            if (subpixelStep != 0 &&
+                !((chunk.outcode[0][i] | chunk.outcode[1][i] | chunk.outcode[2][i]) & OUTCODE_GUARD_BAND)) {
+                float snapped[3][2];
+                for (int k = 0; k < 3; ++k) {
+                    for (int c = 0; c < 2; ++c) snapped[k][c] = std::round(s[k][c][i] * subpixelStep);
+                }
+                float edge1X = snapped[1][0] - snapped[0][0], edge1Y = snapped[1][1] - snapped[0][1];
+                float edge2X = snapped[2][0] - snapped[0][0], edge2Y = snapped[2][1] - snapped[0][1];
+                if ((double) edge1X * edge2Y == (double) edge1Y * edge2X) continue;
+            }
+            mask |= 1u << i;
+        }
+        return mask;
+    }
+
+#ifdef RASTERIZER_KERNEL_X86
+
+    // row r of the column major matrix m times the vectors v, summed in the same order as the scalar kernel
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static __m128 transformRowSSE4_1(const float *m, int size, const __m128 *v, int r) {
+        __m128 sum = _mm_mul_ps(_mm_set1_ps(m[r]), v[0]);
+        for (int k = 1; k < size; ++k) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[k * size + r]), v[k]));
+        return sum;
+    }
+
+    // the same distances as getOutcode, a bit is set where a distance is not >= 0
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static __m128i outcodeSSE4_1(__m128 x, __m128 y, __m128 z, __m128 w) {
+        __m128 guardBandW = _mm_mul_ps(_mm_set1_ps(GUARD_BAND), w);
+        __m128 distances[OUTCODE_PANE_COUNT] = {_mm_add_ps(z, w), _mm_sub_ps(w, z), _mm_add_ps(x, w), _mm_sub_ps(w, x),
+                                                _mm_add_ps(y, w), _mm_sub_ps(w, y),
+                                                _mm_add_ps(x, guardBandW), _mm_sub_ps(guardBandW, x),
+                                                _mm_add_ps(y, guardBandW), _mm_sub_ps(guardBandW, y)};
+        __m128i outcode = _mm_setzero_si128();
+        for (int pane = 0; pane < OUTCODE_PANE_COUNT; ++pane) {
+            __m128i outside = _mm_castps_si128(_mm_cmpnge_ps(distances[pane], _mm_setzero_ps()));
+            outcode = _mm_or_si128(outcode, _mm_and_si128(outside, _mm_set1_epi32(1 << pane)));
+        }
+        return outcode;
+    }
+
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static void transformVertexChunkSSE4_1(const VertexTransform &transform, const float *const *pos,
+                                           const float *const *normal, VertexChunk &chunk) {
+        for (int half = 0; half < VERTEX_CHUNK_SIZE; half += 4) {
+            __m128 modelPos[4], viewSpacePos[4], clipPos[4], unitNormal[3];
+            for (int c = 0; c < 4; ++c) modelPos[c] = _mm_loadu_ps(pos[c] + half);
+            for (int r = 0; r < 4; ++r) viewSpacePos[r] = transformRowSSE4_1(transform.modelView, 4, modelPos, r);
+            for (int r = 0; r < 4; ++r) clipPos[r] = transformRowSSE4_1(transform.projection, 4, viewSpacePos, r);
+
+            for (int c = 0; c < 3; ++c) unitNormal[c] = _mm_loadu_ps(normal[c] + half);
+            __m128 squaredNorm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(unitNormal[0], unitNormal[0]),
+                                                       _mm_mul_ps(unitNormal[1], unitNormal[1])),
+                                            _mm_mul_ps(unitNormal[2], unitNormal[2]));
+            __m128 norm = _mm_blendv_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(squaredNorm),
+                                        _mm_cmpgt_ps(squaredNorm, _mm_setzero_ps()));
+            for (int c = 0; c < 3; ++c) unitNormal[c] = _mm_div_ps(unitNormal[c], norm);
+
+            __m128 x = clipPos[0], y = clipPos[1], z = clipPos[2], w = clipPos[3];
+            if (!transform.homogeneous) {
+                x = _mm_div_ps(x, w), y = _mm_div_ps(y, w), z = _mm_div_ps(z, w);
+                w = _mm_set1_ps(1.f);
+            }
+            __m128 screenX = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(transform.viewportX), w),
+                                        _mm_mul_ps(_mm_set1_ps(0.5f * transform.viewportWidth), _mm_add_ps(x, w)));
+            __m128 screenY = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(transform.viewportY), w),
+                                        _mm_mul_ps(_mm_set1_ps(0.5f * transform.viewportHeight), _mm_add_ps(y, w)));
+            __m128 screenZ = _mm_mul_ps(_mm_add_ps(z, w), _mm_set1_ps(0.5f));
+
+            for (int c = 0; c < 4; ++c) {
+                _mm_storeu_ps(chunk.viewSpacePos[c] + half, viewSpacePos[c]);
+                _mm_storeu_ps(chunk.clipPos[c] + half, clipPos[c]);
+            }
+            for (int r = 0; r < 3; ++r) {
+                _mm_storeu_ps(chunk.normal[r] + half, transformRowSSE4_1(transform.normal, 3, unitNormal, r));
+            }
+            _mm_storeu_ps(chunk.screenPos[0] + half, screenX);
+            _mm_storeu_ps(chunk.screenPos[1] + half, screenY);
+            _mm_storeu_ps(chunk.screenPos[2] + half, screenZ);
+            _mm_storeu_ps(chunk.screenPos[3] + half, clipPos[3]);
+            _mm_storeu_si128((__m128i *) (chunk.outcode + half),
+                             outcodeSSE4_1(clipPos[0], clipPos[1], clipPos[2], clipPos[3]));
+        }
+    }
+
+    // round half away from zero like llround, v - trunc(v) is exact
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static __m128 roundSSE4_1(__m128 v) {
+        __m128 truncated = _mm_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m128 signMask = _mm_set1_ps(-0.f);
+        __m128 absFraction = _mm_andnot_ps(signMask, _mm_sub_ps(v, truncated));
+        __m128 step = _mm_or_ps(_mm_set1_ps(1.f), _mm_and_ps(signMask, v));
+        return _mm_add_ps(truncated, _mm_and_ps(_mm_cmpge_ps(absFraction, _mm_set1_ps(0.5f)), step));
+    }
+
+    // bit i is set if the triangle of lane i has zero area once snapped, see cullTriangleChunkScalar
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static uint32_t snappedZeroAreaSSE4_1(const TriangleChunk &chunk, int half, float subpixelStep) {
+        __m128 snapped[3][2];
+        for (int k = 0; k < 3; ++k) {
+            for (int c = 0; c < 2; ++c) {
+                snapped[k][c] = roundSSE4_1(_mm_mul_ps(_mm_loadu_ps(chunk.screenPos[k][c] + half),
+                                                       _mm_set1_ps(subpixelStep)));
+            }
+        }
+        __m128 edge1X = _mm_sub_ps(snapped[1][0], snapped[0][0]), edge1Y = _mm_sub_ps(snapped[1][1], snapped[0][1]);
+        __m128 edge2X = _mm_sub_ps(snapped[2][0], snapped[0][0]), edge2Y = _mm_sub_ps(snapped[2][1], snapped[0][1]);
+        uint32_t mask = 0;
+        for (int pair = 0; pair < 4; pair += 2) {
+            if (pair) {
+                edge1X = _mm_movehl_ps(edge1X, edge1X), edge1Y = _mm_movehl_ps(edge1Y, edge1Y);
+                edge2X = _mm_movehl_ps(edge2X, edge2X), edge2Y = _mm_movehl_ps(edge2Y, edge2Y);
+            }
+            __m128d zero = _mm_cmpeq_pd(_mm_mul_pd(_mm_cvtps_pd(edge1X), _mm_cvtps_pd(edge2Y)),
+                                        _mm_mul_pd(_mm_cvtps_pd(edge1Y), _mm_cvtps_pd(edge2X)));
+            mask |= (uint32_t) _mm_movemask_pd(zero) << pair;
+        }
+        return mask;
+    }
+
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static uint32_t cullTriangleChunkSSE4_1(const TriangleChunk &chunk, uint32_t facings, float subpixelStep) {
+        uint32_t mask = 0;
+        for (int half = 0; half < TRIANGLE_CHUNK_SIZE; half += 4) {
+            __m128 p0[3], edge1[3], edge2[3];
+            for (int c = 0; c < 3; ++c) {
+                p0[c] = _mm_loadu_ps(chunk.viewSpacePos[0][c] + half);
+                edge1[c] = _mm_sub_ps(_mm_loadu_ps(chunk.viewSpacePos[1][c] + half), p0[c]);
+                edge2[c] = _mm_sub_ps(_mm_loadu_ps(chunk.viewSpacePos[2][c] + half), p0[c]);
+            }
+            __m128 normal[3];
+            for (int c = 0; c < 3; ++c) {
+                int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+                normal[c] = _mm_sub_ps(_mm_mul_ps(edge1[c1], edge2[c2]), _mm_mul_ps(edge1[c2], edge2[c1]));
+            }
+            __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normal[0], p0[0]), _mm_mul_ps(normal[1], p0[1])),
+                                       _mm_mul_ps(normal[2], p0[2]));
+            __m128 front = _mm_cmpgt_ps(facing, _mm_setzero_ps());
+            __m128 back = _mm_cmplt_ps(facing, _mm_setzero_ps());
+            __m128 keep = _mm_setzero_ps();
+            if (facings & FACING_FRONT) keep = _mm_or_ps(keep, front);
+            if (facings & FACING_BACK) keep = _mm_or_ps(keep, back);
+            if (facings & FACING_EDGE_ON) keep = _mm_or_ps(keep, _mm_andnot_ps(_mm_or_ps(front, back),
+                                                                              _mm_castsi128_ps(_mm_set1_epi32(-1))));
+
+            __m128i outcode = _mm_and_si128(_mm_and_si128(_mm_loadu_si128((const __m128i *) (chunk.outcode[0] + half)),
+                                                          _mm_loadu_si128((const __m128i *) (chunk.outcode[1] + half))),
+                                            _mm_loadu_si128((const __m128i *) (chunk.outcode[2] + half)));
+            __m128i inside = _mm_cmpeq_epi32(_mm_and_si128(outcode, _mm_set1_epi32(OUTCODE_FRUSTUM)),
+                                             _mm_setzero_si128());
+            auto survivors = (uint32_t) _mm_movemask_ps(_mm_and_ps(keep, _mm_castsi128_ps(inside)));
+
+            if (subpixelStep != 0 && survivors) {
+                __m128i outcodeUnion = _mm_or_si128(
+                        _mm_or_si128(_mm_loadu_si128((const __m128i *) (chunk.outcode[0] + half)),
+                                     _mm_loadu_si128((const __m128i *) (chunk.outcode[1] + half))),
+                        _mm_loadu_si128((const __m128i *) (chunk.outcode[2] + half)));
+                __m128i inGuardBand = _mm_cmpeq_epi32(_mm_and_si128(outcodeUnion, _mm_set1_epi32(OUTCODE_GUARD_BAND)),
+                                                      _mm_setzero_si128());
+                survivors &= ~(snappedZeroAreaSSE4_1(chunk, half, subpixelStep) &
+                               (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(inGuardBand)));
+            }
+            mask |= survivors << half;
+        }
+        return mask;
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static __m128 depthTestPassSSE4_1(__m128 z, __m128 depth) {
+        if constexpr (depthTest == DEPTH_LESS) return _mm_cmplt_ps(z, depth);
+        else if constexpr (depthTest == DEPTH_LESS_EQUAL) return _mm_cmple_ps(z, depth);
+        else return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static uint32_t coverageSpanSSE4_1(const int32_t *edge, const int32_t *edgeStep, float z, float zStep,
+                                       const float *depth, int count, float *zOut) {
+        // never read depth after the span
+        float depthPadded[SPAN_SIZE] = {};
+        if (count < SPAN_SIZE) {
+            for (int i = 0; i < count; ++i) depthPadded[i] = depth[i];
+            depth = depthPadded;
+        }
+
+        uint32_t mask = 0;
+        for (int half = 0; half < SPAN_SIZE; half += 4) {
+            __m128i lane = _mm_setr_epi32(half, half + 1, half + 2, half + 3);
+            __m128i edge0 = _mm_add_epi32(_mm_set1_epi32(edge[0]), _mm_mullo_epi32(lane, _mm_set1_epi32(edgeStep[0])));
+            __m128i edge1 = _mm_add_epi32(_mm_set1_epi32(edge[1]), _mm_mullo_epi32(lane, _mm_set1_epi32(edgeStep[1])));
+            __m128i edge2 = _mm_add_epi32(_mm_set1_epi32(edge[2]), _mm_mullo_epi32(lane, _mm_set1_epi32(edgeStep[2])));
+            __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(edge0, edge1), edge2), _mm_set1_epi32(-1));
+
+            __m128 pixelZ = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_cvtepi32_ps(lane), _mm_set1_ps(zStep)));
+            _mm_storeu_ps(zOut + half, pixelZ);
+            __m128 zPass = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(pixelZ, _mm_setzero_ps()),
+                                                 _mm_cmple_ps(pixelZ, _mm_set1_ps(1.f))),
+                                      depthTestPassSSE4_1<depthTest>(pixelZ, _mm_loadu_ps(depth + half)));
+
+            mask |= (uint32_t) _mm_movemask_ps(_mm_and_ps(_mm_castsi128_ps(inside), zPass)) << half;
+        }
+        return mask & ((1u << count) - 1);
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("sse4.1")
+    static uint32_t depthSpanSSE4_1(float z, float zStep, const float *depth, int count, float *zOut) {
+        // never read depth after the span
+        float depthPadded[SPAN_SIZE] = {};
+        if (count < SPAN_SIZE) {
+            for (int i = 0; i < count; ++i) depthPadded[i] = depth[i];
+            depth = depthPadded;
+        }
+
+        uint32_t mask = 0;
+        for (int half = 0; half < SPAN_SIZE; half += 4) {
+            __m128 lane = _mm_setr_ps((float) half, (float) half + 1, (float) half + 2, (float) half + 3);
+            __m128 pixelZ = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(lane, _mm_set1_ps(zStep)));
+            _mm_storeu_ps(zOut + half, pixelZ);
+            __m128 zPass = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(pixelZ, _mm_setzero_ps()),
+                                                 _mm_cmple_ps(pixelZ, _mm_set1_ps(1.f))),
+                                      depthTestPassSSE4_1<depthTest>(pixelZ, _mm_loadu_ps(depth + half)));
+            mask |= (uint32_t) _mm_movemask_ps(zPass) << half;
+        }
+        return mask & ((1u << count) - 1);
+    }
+
+    template<DepthTest depthTest>
+    constexpr int depthTestPredicate = depthTest == DEPTH_LESS ? _CMP_LT_OQ :
+                                       depthTest == DEPTH_LESS_EQUAL ? _CMP_LE_OQ : _CMP_TRUE_UQ;
+
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static __m256 transformRowAVX2(const float *m, int size, const __m256 *v, int r) {
+        __m256 sum = _mm256_mul_ps(_mm256_set1_ps(m[r]), v[0]);
+        for (int k = 1; k < size; ++k) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m[k * size + r]), v[k]));
+        return sum;
+    }
+
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static __m256i outcodeAVX2(__m256 x, __m256 y, __m256 z, __m256 w) {
+        __m256 guardBandW = _mm256_mul_ps(_mm256_set1_ps(GUARD_BAND), w);
+        __m256 distances[OUTCODE_PANE_COUNT] = {_mm256_add_ps(z, w), _mm256_sub_ps(w, z),
+                                                _mm256_add_ps(x, w), _mm256_sub_ps(w, x),
+                                                _mm256_add_ps(y, w), _mm256_sub_ps(w, y),
+                                                _mm256_add_ps(x, guardBandW), _mm256_sub_ps(guardBandW, x),
+                                                _mm256_add_ps(y, guardBandW), _mm256_sub_ps(guardBandW, y)};
+        __m256i outcode = _mm256_setzero_si256();
+        for (int pane = 0; pane < OUTCODE_PANE_COUNT; ++pane) {
+            __m256i outside = _mm256_castps_si256(_mm256_cmp_ps(distances[pane], _mm256_setzero_ps(), _CMP_NGE_UQ));
+            outcode = _mm256_or_si256(outcode, _mm256_and_si256(outside, _mm256_set1_epi32(1 << pane)));
+        }
+        return outcode;
+    }
+
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static void transformVertexChunkAVX2(const VertexTransform &transform, const float *const *pos,
+                                         const float *const *normal, VertexChunk &chunk) {
+        __m256 modelPos[4], viewSpacePos[4], clipPos[4], unitNormal[3];
+        for (int c = 0; c < 4; ++c) modelPos[c] = _mm256_loadu_ps(pos[c]);
+        for (int r = 0; r < 4; ++r) viewSpacePos[r] = transformRowAVX2(transform.modelView, 4, modelPos, r);
+        for (int r = 0; r < 4; ++r) clipPos[r] = transformRowAVX2(transform.projection, 4, viewSpacePos, r);
+
+        for (int c = 0; c < 3; ++c) unitNormal[c] = _mm256_loadu_ps(normal[c]);
+        __m256 squaredNorm = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(unitNormal[0], unitNormal[0]),
+                                                         _mm256_mul_ps(unitNormal[1], unitNormal[1])),
+                                           _mm256_mul_ps(unitNormal[2], unitNormal[2]));
+        __m256 norm = _mm256_blendv_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(squaredNorm),
+                                       _mm256_cmp_ps(squaredNorm, _mm256_setzero_ps(), _CMP_GT_OQ));
+        for (int c = 0; c < 3; ++c) unitNormal[c] = _mm256_div_ps(unitNormal[c], norm);
+
+        __m256 x = clipPos[0], y = clipPos[1], z = clipPos[2], w = clipPos[3];
+        if (!transform.homogeneous) {
+            x = _mm256_div_ps(x, w), y = _mm256_div_ps(y, w), z = _mm256_div_ps(z, w);
+            w = _mm256_set1_ps(1.f);
+        }
+        __m256 screenX = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(transform.viewportX), w),
+                                       _mm256_mul_ps(_mm256_set1_ps(0.5f * transform.viewportWidth),
+                                                     _mm256_add_ps(x, w)));
+        __m256 screenY = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(transform.viewportY), w),
+                                       _mm256_mul_ps(_mm256_set1_ps(0.5f * transform.viewportHeight),
+                                                     _mm256_add_ps(y, w)));
+        __m256 screenZ = _mm256_mul_ps(_mm256_add_ps(z, w), _mm256_set1_ps(0.5f));
+
+        for (int c = 0; c < 4; ++c) {
+            _mm256_storeu_ps(chunk.viewSpacePos[c], viewSpacePos[c]);
+            _mm256_storeu_ps(chunk.clipPos[c], clipPos[c]);
+        }
+        for (int r = 0; r < 3; ++r) {
+            _mm256_storeu_ps(chunk.normal[r], transformRowAVX2(transform.normal, 3, unitNormal, r));
+        }
+        _mm256_storeu_ps(chunk.screenPos[0], screenX);
+        _mm256_storeu_ps(chunk.screenPos[1], screenY);
+        _mm256_storeu_ps(chunk.screenPos[2], screenZ);
+        _mm256_storeu_ps(chunk.screenPos[3], clipPos[3]);
+        _mm256_storeu_si256((__m256i *) chunk.outcode, outcodeAVX2(clipPos[0], clipPos[1], clipPos[2], clipPos[3]));
+    }
+
+    // round half away from zero like llround, v - trunc(v) is exact
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static __m256 roundAVX2(__m256 v) {
+        __m256 truncated = _mm256_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256 signMask = _mm256_set1_ps(-0.f);
+        __m256 absFraction = _mm256_andnot_ps(signMask, _mm256_sub_ps(v, truncated));
+        __m256 step = _mm256_or_ps(_mm256_set1_ps(1.f), _mm256_and_ps(signMask, v));
+        return _mm256_add_ps(truncated,
+                             _mm256_and_ps(_mm256_cmp_ps(absFraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ), step));
+    }
+
+    // bit i is set if triangle i has zero area once snapped, see cullTriangleChunkScalar
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static uint32_t snappedZeroAreaAVX2(const TriangleChunk &chunk, float subpixelStep) {
+        __m256 snapped[3][2];
+        for (int k = 0; k < 3; ++k) {
+            for (int c = 0; c < 2; ++c) {
+                snapped[k][c] = roundAVX2(_mm256_mul_ps(_mm256_loadu_ps(chunk.screenPos[k][c]),
+                                                        _mm256_set1_ps(subpixelStep)));
+            }
+        }
+        __m256 edge1X = _mm256_sub_ps(snapped[1][0], snapped[0][0]);
+        __m256 edge1Y = _mm256_sub_ps(snapped[1][1], snapped[0][1]);
+        __m256 edge2X = _mm256_sub_ps(snapped[2][0], snapped[0][0]);
+        __m256 edge2Y = _mm256_sub_ps(snapped[2][1], snapped[0][1]);
+        __m256d lowZero = _mm256_cmp_pd(
+                _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(edge1X)),
+                              _mm256_cvtps_pd(_mm256_castps256_ps128(edge2Y))),
+                _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(edge1Y)),
+                              _mm256_cvtps_pd(_mm256_castps256_ps128(edge2X))), _CMP_EQ_OQ);
+        __m256d highZero = _mm256_cmp_pd(
+                _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(edge1X, 1)),
+                              _mm256_cvtps_pd(_mm256_extractf128_ps(edge2Y, 1))),
+                _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(edge1Y, 1)),
+                              _mm256_cvtps_pd(_mm256_extractf128_ps(edge2X, 1))), _CMP_EQ_OQ);
+        return (uint32_t) _mm256_movemask_pd(lowZero) | (uint32_t) _mm256_movemask_pd(highZero) << 4;
+    }
+
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static uint32_t cullTriangleChunkAVX2(const TriangleChunk &chunk, uint32_t facings, float subpixelStep) {
+        __m256 p0[3], edge1[3], edge2[3];
+        for (int c = 0; c < 3; ++c) {
+            p0[c] = _mm256_loadu_ps(chunk.viewSpacePos[0][c]);
+            edge1[c] = _mm256_sub_ps(_mm256_loadu_ps(chunk.viewSpacePos[1][c]), p0[c]);
+            edge2[c] = _mm256_sub_ps(_mm256_loadu_ps(chunk.viewSpacePos[2][c]), p0[c]);
+        }
+        __m256 normal[3];
+        for (int c = 0; c < 3; ++c) {
+            int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+            normal[c] = _mm256_sub_ps(_mm256_mul_ps(edge1[c1], edge2[c2]), _mm256_mul_ps(edge1[c2], edge2[c1]));
+        }
+        __m256 facing = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normal[0], p0[0]), _mm256_mul_ps(normal[1], p0[1])),
+                                      _mm256_mul_ps(normal[2], p0[2]));
+        __m256 front = _mm256_cmp_ps(facing, _mm256_setzero_ps(), _CMP_GT_OQ);
+        __m256 back = _mm256_cmp_ps(facing, _mm256_setzero_ps(), _CMP_LT_OQ);
+        __m256 keep = _mm256_setzero_ps();
+        if (facings & FACING_FRONT) keep = _mm256_or_ps(keep, front);
+        if (facings & FACING_BACK) keep = _mm256_or_ps(keep, back);
+        if (facings & FACING_EDGE_ON) keep = _mm256_or_ps(keep, _mm256_cmp_ps(facing, _mm256_setzero_ps(), _CMP_EQ_UQ));
+
+        __m256i outcode = _mm256_and_si256(_mm256_and_si256(_mm256_loadu_si256((const __m256i *) chunk.outcode[0]),
+                                                            _mm256_loadu_si256((const __m256i *) chunk.outcode[1])),
+                                           _mm256_loadu_si256((const __m256i *) chunk.outcode[2]));
+        __m256i inside = _mm256_cmpeq_epi32(_mm256_and_si256(outcode, _mm256_set1_epi32(OUTCODE_FRUSTUM)),
+                                            _mm256_setzero_si256());
+        auto survivors = (uint32_t) _mm256_movemask_ps(_mm256_and_ps(keep, _mm256_castsi256_ps(inside)));
+
+        if (subpixelStep != 0 && survivors) {
+            __m256i outcodeUnion = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_loadu_si256((const __m256i *) chunk.outcode[0]),
+                                    _mm256_loadu_si256((const __m256i *) chunk.outcode[1])),
+                    _mm256_loadu_si256((const __m256i *) chunk.outcode[2]));
+            __m256i inGuardBand = _mm256_cmpeq_epi32(
+                    _mm256_and_si256(outcodeUnion, _mm256_set1_epi32(OUTCODE_GUARD_BAND)), _mm256_setzero_si256());
+            survivors &= ~(snappedZeroAreaAVX2(chunk, subpixelStep) &
+                           (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(inGuardBand)));
+        }
+        return survivors;
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static uint32_t coverageSpanAVX2(const int32_t *edge, const int32_t *edgeStep, float z, float zStep,
+                                     const float *depth, int count, float *zOut) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i edge0 = _mm256_add_epi32(_mm256_set1_epi32(edge[0]),
+                                         _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeStep[0])));
+        __m256i edge1 = _mm256_add_epi32(_mm256_set1_epi32(edge[1]),
+                                         _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeStep[1])));
+        __m256i edge2 = _mm256_add_epi32(_mm256_set1_epi32(edge[2]),
+                                         _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeStep[2])));
+        __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(edge0, edge1), edge2),
+                                            _mm256_set1_epi32(-1));
+
+        // never read depth after the span
+        __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), lane);
+        __m256 spanDepth = _mm256_maskload_ps(depth, valid);
+
+        __m256 pixelZ = _mm256_add_ps(_mm256_set1_ps(z), _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(zStep)));
+        _mm256_storeu_ps(zOut, pixelZ);
+        __m256 zPass = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(pixelZ, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                                   _mm256_cmp_ps(pixelZ, _mm256_set1_ps(1.f), _CMP_LE_OQ)),
+                                     _mm256_cmp_ps(pixelZ, spanDepth, depthTestPredicate<depthTest>));
+
+        __m256 covered = _mm256_and_ps(_mm256_castsi256_ps(_mm256_and_si256(inside, valid)), zPass);
+        return (uint32_t) _mm256_movemask_ps(covered);
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("avx2")
+    static uint32_t depthSpanAVX2(float z, float zStep, const float *depth, int count, float *zOut) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+        // never read depth after the span
+        __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), lane);
+        __m256 spanDepth = _mm256_maskload_ps(depth, valid);
+
+        __m256 pixelZ = _mm256_add_ps(_mm256_set1_ps(z), _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(zStep)));
+        _mm256_storeu_ps(zOut, pixelZ);
+        __m256 zPass = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(pixelZ, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                                   _mm256_cmp_ps(pixelZ, _mm256_set1_ps(1.f), _CMP_LE_OQ)),
+                                     _mm256_cmp_ps(pixelZ, spanDepth, depthTestPredicate<depthTest>));
+        return (uint32_t) _mm256_movemask_ps(_mm256_and_ps(_mm256_castsi256_ps(valid), zPass));
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("avx512f,avx512vl")
+    static uint32_t coverageSpanAVX512(const int32_t *edge, const int32_t *edgeStep, float z, float zStep,
+                                       const float *depth, int count, float *zOut) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i edge0 = _mm256_add_epi32(_mm256_set1_epi32(edge[0]),
+                                         _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeStep[0])));
+        __m256i edge1 = _mm256_add_epi32(_mm256_set1_epi32(edge[1]),
+                                         _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeStep[1])));
+        __m256i edge2 = _mm256_add_epi32(_mm256_set1_epi32(edge[2]),
+                                         _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeStep[2])));
+
+        // never read depth after the span
+        auto valid = (__mmask8) ((1u << count) - 1);
+        __mmask8 inside = _mm256_mask_cmpge_epi32_mask(
+                valid, _mm256_or_si256(_mm256_or_si256(edge0, edge1), edge2), _mm256_setzero_si256());
+        __m256 spanDepth = _mm256_maskz_loadu_ps(valid, depth);
+
+        __m256 pixelZ = _mm256_add_ps(_mm256_set1_ps(z), _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(zStep)));
+        _mm256_storeu_ps(zOut, pixelZ);
+        __mmask8 covered = _mm256_mask_cmp_ps_mask(inside, pixelZ, _mm256_setzero_ps(), _CMP_GE_OQ);
+        covered = _mm256_mask_cmp_ps_mask(covered, pixelZ, _mm256_set1_ps(1.f), _CMP_LE_OQ);
+        covered = _mm256_mask_cmp_ps_mask(covered, pixelZ, spanDepth, depthTestPredicate<depthTest>);
+        return covered;
+    }
+
+    template<DepthTest depthTest>
+    RASTERIZER_KERNEL_TARGET("avx512f,avx512vl")
+    static uint32_t depthSpanAVX512(float z, float zStep, const float *depth, int count, float *zOut) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+        // never read depth after the span
+        auto valid = (__mmask8) ((1u << count) - 1);
+        __m256 spanDepth = _mm256_maskz_loadu_ps(valid, depth);
+
+        __m256 pixelZ = _mm256_add_ps(_mm256_set1_ps(z), _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(zStep)));
+        _mm256_storeu_ps(zOut, pixelZ);
+        __mmask8 covered = _mm256_mask_cmp_ps_mask(valid, pixelZ, _mm256_setzero_ps(), _CMP_GE_OQ);
+        covered = _mm256_mask_cmp_ps_mask(covered, pixelZ, _mm256_set1_ps(1.f), _CMP_LE_OQ);
+        covered = _mm256_mask_cmp_ps_mask(covered, pixelZ, spanDepth, depthTestPredicate<depthTest>);
+        return covered;
+    }
+
+#endif
+
+    static const Kernel kernels[] = {
+            {SCALAR, "Scalar",
+                    {coverageSpanScalar<DEPTH_LESS>, coverageSpanScalar<DEPTH_LESS_EQUAL>,
+                     coverageSpanScalar<DEPTH_ALWAYS>},
+                    {depthSpanScalar<DEPTH_LESS>, depthSpanScalar<DEPTH_LESS_EQUAL>,
+                     depthSpanScalar<DEPTH_ALWAYS>},
+                    transformVertexChunkScalar, cullTriangleChunkScalar},
+#ifdef RASTERIZER_KERNEL_X86
+            {SSE4_1, "SSE4.1",
+                    {coverageSpanSSE4_1<DEPTH_LESS>, coverageSpanSSE4_1<DEPTH_LESS_EQUAL>,
+                     coverageSpanSSE4_1<DEPTH_ALWAYS>},
+                    {depthSpanSSE4_1<DEPTH_LESS>, depthSpanSSE4_1<DEPTH_LESS_EQUAL>,
+                     depthSpanSSE4_1<DEPTH_ALWAYS>},
+                    transformVertexChunkSSE4_1, cullTriangleChunkSSE4_1},
+            {AVX2,   "AVX2",
+                    {coverageSpanAVX2<DEPTH_LESS>, coverageSpanAVX2<DEPTH_LESS_EQUAL>,
+                     coverageSpanAVX2<DEPTH_ALWAYS>},
+                    {depthSpanAVX2<DEPTH_LESS>, depthSpanAVX2<DEPTH_LESS_EQUAL>,
+                     depthSpanAVX2<DEPTH_ALWAYS>},
+                    transformVertexChunkAVX2, cullTriangleChunkAVX2},
+            {AVX512, "AVX-512",
+                    {coverageSpanAVX512<DEPTH_LESS>, coverageSpanAVX512<DEPTH_LESS_EQUAL>,
+                     coverageSpanAVX512<DEPTH_ALWAYS>},
+                    {depthSpanAVX512<DEPTH_LESS>, depthSpanAVX512<DEPTH_LESS_EQUAL>,
+                     depthSpanAVX512<DEPTH_ALWAYS>},
+                    // a chunk is as wide as a ymm register, the avx2 kernels are used as they are
+                    transformVertexChunkAVX2, cullTriangleChunkAVX2},
+#endif
+    };
+
+    bool isSupported(InstructionSet instructionSet) {
+#ifdef RASTERIZER_KERNEL_X86
+        int leaf1[4] = {}, leaf7[4] = {};
+#ifdef _MSC_VER
+        __cpuid(leaf1, 1);
+        __cpuidex(leaf7, 7, 0);
+#else
+        __cpuid_count(1, 0, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+        __cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+        bool sse4_1 = leaf1[2] & (1 << 19);
+        bool osxsave = leaf1[2] & (1 << 27);
+        bool avx2 = leaf7[1] & (1 << 5);
+        bool avx512f = leaf7[1] & (1 << 16);
+        bool avx512vl = (uint32_t) leaf7[1] & (1u << 31);
+
+        // the os must also save the ymm (and zmm) registers on context switches
+        uint64_t xcr0 = 0;
+        if (osxsave) {
+#ifdef _MSC_VER
+            xcr0 = _xgetbv(0);
+#else
+            uint32_t eax, edx;
+            __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            xcr0 = ((uint64_t) edx << 32) | eax;
+#endif
+        }
+        bool ymmEnabled = (xcr0 & 0x06) == 0x06;
+        bool zmmEnabled = (xcr0 & 0xe6) == 0xe6;
+
+        switch (instructionSet) {
+            case SCALAR:
+                return true;
+            case SSE4_1:
+                return sse4_1;
+            case AVX2:
+                return avx2 && ymmEnabled;
+            case AVX512:
+                return avx512f && avx512vl && zmmEnabled;
+        }
+        return false;
+#else
+        return instructionSet == SCALAR;
+#endif
+    }
+
+    const Kernel &getKernel(InstructionSet instructionSet) {
+        for (auto &kernel: kernels) {
+            if (kernel.instructionSet == instructionSet) return kernel;
+        }
+        return kernels[0];
+    }
+
+    const Kernel &getKernel() {
+        static const Kernel &bestKernel = getKernel([]() {
+            for (int instructionSet = AVX512; instructionSet > SCALAR; --instructionSet) {
+                if (isSupported((InstructionSet) instructionSet)) return (InstructionSet) instructionSet;
+            }
+            return SCALAR;
+        }());
+        return bestKernel;
+    }
+}
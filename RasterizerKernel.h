@@ -0,0 +1,162 @@
+//
+// Created by .torrent on 2026/10/17.
+//
+
+#ifndef CG_BASIC_RASTERIZERKERNEL_H
+#define CG_BASIC_RASTERIZERKERNEL_H
+
+#include <cstdint>
+
+namespace RasterizerKernel {
+    // pixels evaluated by one kernel call, a 8x1 span in a row
+    constexpr int SPAN_SIZE = 8;
+
+    enum InstructionSet {
+        SCALAR, SSE4_1, AVX2, AVX512
+    };
+
+    // how z of a pixel is compared with the depth buffer, each kernel is compiled once per test,
+    // DEPTH_ALWAYS still rejects z out of [0, 1]
+    enum DepthTest {
+        DEPTH_LESS, DEPTH_LESS_EQUAL, DEPTH_ALWAYS, DEPTH_TEST_COUNT
+    };
+
+    // verts transformed by one vertex kernel call
+    constexpr int VERTEX_CHUNK_SIZE = 8;
+
+    // the guard band spans GUARD_BAND times the screen in x and y, screen space positions in it stay small enough
+    // for the fixed point rasterizer
+    constexpr float GUARD_BAND = 8;
+
+    // bits of the outcode of a vert, set if its clip space position is outside the plane, dot(pos, paneCoeff) >= 0
+    // inside, see Renderer::clipTriangle for the planes
+    enum Outcode : uint32_t {
+        OUTCODE_NEAR = 1 << 0, OUTCODE_FAR = 1 << 1,
+        OUTCODE_LEFT = 1 << 2, OUTCODE_RIGHT = 1 << 3, OUTCODE_BOTTOM = 1 << 4, OUTCODE_TOP = 1 << 5,
+        OUTCODE_GUARD_BAND_LEFT = 1 << 6, OUTCODE_GUARD_BAND_RIGHT = 1 << 7,
+        OUTCODE_GUARD_BAND_BOTTOM = 1 << 8, OUTCODE_GUARD_BAND_TOP = 1 << 9,
+        OUTCODE_FRUSTUM = OUTCODE_NEAR | OUTCODE_FAR | OUTCODE_LEFT | OUTCODE_RIGHT | OUTCODE_BOTTOM | OUTCODE_TOP,
+        OUTCODE_GUARD_BAND = OUTCODE_NEAR | OUTCODE_GUARD_BAND_LEFT | OUTCODE_GUARD_BAND_RIGHT |
+                             OUTCODE_GUARD_BAND_BOTTOM | OUTCODE_GUARD_BAND_TOP
+    };
+
+    // panes with a bit in the outcode
+    constexpr int OUTCODE_PANE_COUNT = 10;
+
+    // a NaN distance counts as outside like in the clipper
+    inline uint32_t getOutcode(float x, float y, float z, float w) {
+        float distances[OUTCODE_PANE_COUNT] = {z + w, w - z, x + w, w - x, y + w, w - y,
+                                               x + GUARD_BAND * w, GUARD_BAND * w - x,
+                                               y + GUARD_BAND * w, GUARD_BAND * w - y};
+        uint32_t outcode = 0;
+        for (int pane = 0; pane < OUTCODE_PANE_COUNT; ++pane) {
+            if (!(distances[pane] >= 0)) outcode |= 1u << pane;
+        }
+        return outcode;
+    }
+
+    // the transforms of the vertex stage, matrices are column major as in Eigen, the viewport maps [-1, 1] to
+    // [x, x + width] and [y, y + height], screen positions are left undivided for the homogeneous rasterizer
+    struct VertexTransform {
+        float modelView[16];
+        float projection[16];
+        float normal[9];
+        float viewportX, viewportY, viewportWidth, viewportHeight;
+        bool homogeneous;
+    };
+
+    // a chunk of transformed verts in structure of arrays, component c of vert i is at [c][i]
+    struct VertexChunk {
+        float viewSpacePos[4][VERTEX_CHUNK_SIZE];
+        float clipPos[4][VERTEX_CHUNK_SIZE];
+        float screenPos[4][VERTEX_CHUNK_SIZE];
+        float normal[3][VERTEX_CHUNK_SIZE];
+        uint32_t outcode[VERTEX_CHUNK_SIZE];
+    };
+
+    typedef void (*VertexChunkFunction)(const VertexTransform &transform, const float *const *pos,
+                                        const float *const *normal, VertexChunk &chunk);
+
+    // triangles culled by one cull kernel call
+    constexpr int TRIANGLE_CHUNK_SIZE = 8;
+
+    // which side of a triangle faces the eye, by the sign of dot(cross(v1 - v0, v2 - v0), v0) of its view space
+    // positions, the triangle is edge-on and has no area on screen if it is 0
+    enum Facing : uint32_t {
+        FACING_FRONT = 1 << 0, FACING_BACK = 1 << 1, FACING_EDGE_ON = 1 << 2
+    };
+
+    // the verts of a chunk of triangles in structure of arrays, component c of vert k of triangle i is at [k][c][i]
+    struct TriangleChunk {
+        float viewSpacePos[3][3][TRIANGLE_CHUNK_SIZE];
+        // x and y of the divided screen space positions, only read if the snapped area is tested
+        float screenPos[3][2][TRIANGLE_CHUNK_SIZE];
+        uint32_t outcode[3][TRIANGLE_CHUNK_SIZE];
+    };
+
+    typedef uint32_t (*TriangleChunkFunction)(const TriangleChunk &chunk, uint32_t facings, float subpixelStep);
+
+    typedef uint32_t (*CoverageSpanFunction)(const int32_t *edge, const int32_t *edgeStep, float z, float zStep,
+                                             const float *depth, int count, float *zOut);
+
+    typedef uint32_t (*DepthSpanFunction)(float z, float zStep, const float *depth, int count, float *zOut);
+
+    struct Kernel {
+        InstructionSet instructionSet;
+        const char *name;
+
+        /**
+         * evaluate the three edge functions and z of a span of pixels, then test z against the depth buffer
+         * @param edge edge values at the first pixel, inside if all E_i >= 0
+         * @param edgeStep change of the edge values from one pixel to the next
+         * @param z z at the first pixel
+         * @param zStep change of z from one pixel to the next
+         * @param depth depth buffer values of the span
+         * @param count pixels actually in the span, 1 ~ SPAN_SIZE, pixels and depth after it are never touched
+         * @param zOut z of every pixel in the span, may differ in the last bit between instruction sets
+         * @return bit i is set if pixel i is inside the triangle, in [0, 1] depth range and passes the z test
+         */
+        CoverageSpanFunction coverageSpan[DEPTH_TEST_COUNT];
+
+        /**
+         * same as coverageSpan for a span known to be fully inside the triangle, only z is tested
+         */
+        DepthSpanFunction depthSpan[DEPTH_TEST_COUNT];
+
+        /**
+         * the whole vertex stage of a chunk of verts: model-view, projection and normal transforms, the homogeneous
+         * division and the viewport transform, the screen position keeps w of the clip space position,
+         * and the outcode of every clip space position
+         * @param pos components of the model space positions of the chunk, VERTEX_CHUNK_SIZE floats each
+         * @param normal components of the model space normals of the chunk, normalized before they are transformed
+         */
+        VertexChunkFunction transformVertexChunk;
+
+        /**
+         * cull a chunk of triangles, NaN positions count as edge-on
+         * @param facings Facing bits of the triangles to keep
+         * @param subpixelStep if not 0, also reject the triangles with zero area once their screen positions are
+         * rounded to 1 / subpixelStep pixel like TriangleSetup::setupFixedPoint does, only tested on triangles
+         * inside the guard band, whose screen positions are small enough to round and multiply exactly
+         * @return bit i is set if triangle i faces one of `facings` and is not entirely outside a pane of the
+         * view frustum
+         */
+        TriangleChunkFunction cullTriangleChunk;
+    };
+
+    /**
+     * get the fastest kernel the cpu supports, detected by cpuid on the first call
+     */
+    const Kernel &getKernel();
+
+    /**
+     * get the kernel of an instruction set, the scalar kernel if none is compiled for it, the caller makes sure the cpu
+     * supports it
+     */
+    const Kernel &getKernel(InstructionSet instructionSet);
+
+    bool isSupported(InstructionSet instructionSet);
+}
+
+
+#endif //CG_BASIC_RASTERIZERKERNEL_H
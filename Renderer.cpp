@@ -2,8 +2,9 @@
 // Created by admin on 2022/9/19.
 //
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
-#include <queue>
 #include "Renderer.h"
 #include "Rasterizer.h"
 #include "ScreenBuffer.h"
@@ -11,7 +12,9 @@
 #include "TransformMatrix.h"
 
 Renderer::Renderer(ScreenBuffer &screenBuffer, CameraObject &cameraObject) : screenBuffer(screenBuffer),
-                                                                             cameraObject(cameraObject) {};
+                                                                             cameraObject(cameraObject),
+                                                                             viewport(screenBuffer.getRect()),
+                                                                             scissor(screenBuffer.getRect()) {};
 
 // transform the light from world space to view space
 void Renderer::transformLights() {
@@ -22,197 +25,485 @@ void Renderer::transformLights() {
     }
 }
 
+/**
+ * only triangles drawn by the fixed point rasterizer take part in the depth pre-pass, so that the depth written by the
+ * depth pass is exactly what the shading pass computes again, other geometries are drawn as usual in the shading pass,
+ * the depth pre-pass only fills the depth buffer of one sample per pixel and is skipped when multisampling
+ */
+bool Renderer::isDepthPrePassed() const {
+    return renderPass != PASS_FORWARD && !screenBuffer.hasMultisampleBuffer() &&
+           renderOption.zTest && renderOption.zWrite &&
+           renderOption.renderMode == RenderOption::MODE_DEFAULT &&
+           renderOption.rasterization == RenderOption::RASTER_FIXED_POINT;
+}
+
+/**
+ * filled triangles drawn by the homogeneous rasterizer are neither clipped nor divided by w,
+ * multisampling and lines work on clipped screen space triangles
+ */
+bool Renderer::isHomogeneous() const {
+    return renderOption.rasterization == RenderOption::RASTER_HOMOGENEOUS &&
+           renderOption.renderMode == RenderOption::MODE_DEFAULT && !screenBuffer.hasMultisampleBuffer();
+}
+
+/**
+ * the vertex stage, transform the verts of the mesh a chunk at a time from its arrays into `vertexes` with the vertex
+ * kernel, the same as Shader::basicVertexShader on every vert, the screen positions go to `screenPositions`
+ */
+void Renderer::transformVertexes(const Primitive::VertexArrays &meshVertexes, const Eigen::Matrix4f &modelViewMatrix,
+                                 bool homogeneous) {
+    constexpr int chunkSize = Primitive::VertexArrays::CHUNK_SIZE;
+    static_assert(chunkSize == RasterizerKernel::VERTEX_CHUNK_SIZE);
+
+    RasterizerKernel::VertexTransform transform{};
+    std::copy_n(modelViewMatrix.data(), 16, transform.modelView);
+    std::copy_n(projectionMatrix.data(), 16, transform.projection);
+    std::copy_n(normalMatrix.data(), 9, transform.normal);
+    transform.viewportX = (float) viewport.x;
+    transform.viewportY = (float) viewport.y;
+    transform.viewportWidth = (float) viewport.width;
+    transform.viewportHeight = (float) viewport.height;
+    transform.homogeneous = homogeneous;
+
+    const RasterizerKernel::Kernel &kernel = RasterizerKernel::getKernel();
+    RasterizerKernel::VertexChunk chunk{};
+    vertexes.resize(meshVertexes.size());
+    screenPositions.resize(meshVertexes.size());
+    vertexOutcodes.resize(meshVertexes.size());
+    for (size_t first = 0; first < meshVertexes.size(); first += chunkSize) {
+        const float *const pos[4] = {&meshVertexes.pos[0][first], &meshVertexes.pos[1][first],
+                                     &meshVertexes.pos[2][first], &meshVertexes.pos[3][first]};
+        const float *const normal[3] = {&meshVertexes.normal[0][first], &meshVertexes.normal[1][first],
+                                        &meshVertexes.normal[2][first]};
+        kernel.transformVertexChunk(transform, pos, normal, chunk);
+
+        int count = (int) std::min<size_t>(chunkSize, meshVertexes.size() - first);
+        for (int i = 0; i < count; ++i) {
+            auto &vertex = vertexes[first + i];
+            vertex.pos = {chunk.clipPos[0][i], chunk.clipPos[1][i], chunk.clipPos[2][i], chunk.clipPos[3][i]};
+            vertex.viewSpacePos = {chunk.viewSpacePos[0][i], chunk.viewSpacePos[1][i], chunk.viewSpacePos[2][i],
+                                   chunk.viewSpacePos[3][i]};
+            vertex.normal = {chunk.normal[0][i], chunk.normal[1][i], chunk.normal[2][i]};
+            vertex.color = {meshVertexes.color[0][first + i], meshVertexes.color[1][first + i],
+                            meshVertexes.color[2][first + i]};
+            vertex.uv = {meshVertexes.uv[0][first + i], meshVertexes.uv[1][first + i]};
+            screenPositions[first + i] = {chunk.screenPos[0][i], chunk.screenPos[1][i], chunk.screenPos[2][i],
+                                          chunk.screenPos[3][i]};
+            vertexOutcodes[first + i] = chunk.outcode[i];
+        }
+    }
+}
+
+/**
+ * the homogeneous division and the viewport transform of a clip space position, the same as the vertex kernel
+ * @param homogeneous map to the viewport in homogeneous coordinates without the division
+ */
+Eigen::Vector4f Renderer::getScreenPosition(const Eigen::Vector4f &clipPos, bool homogeneous) const {
+    Eigen::Vector4f pos = clipPos;
+    if (homogeneous) {
+        // Viewport transformation in homogeneous coordinates, the screen space position is pos.head(3) / w
+        pos.x() = (float) viewport.x * pos.w() + 0.5f * (float) viewport.width * (pos.x() + pos.w());
+        pos.y() = (float) viewport.y * pos.w() + 0.5f * (float) viewport.height * (pos.y() + pos.w());
+        pos.z() = (pos.z() + pos.w()) / 2.f;
+        return pos;
+    }
+
+    // Homogeneous division
+    // clip_space -> ndc_space
+    pos.head(3) /= pos.w();
+
+    // Viewport transformation
+    // ndc_space -> screen_space
+    // [-1, 1] => [x, x + width], [-1, 1] => [y, y + height] of the viewport, [-1, 1] => [0, MAX_DEPTH]
+    pos.x() = (float) viewport.x + 0.5f * (float) viewport.width * (pos.x() + 1.f);
+    pos.y() = (float) viewport.y + 0.5f * (float) viewport.height * (pos.y() + 1.f);
+    pos.z() = (pos.z() + 1.f) / 2.f;
+    return pos;
+}
+
 void Renderer::renderGeometry(const RendererPayload &payload) {
+    if (renderPass == PASS_DEPTH && !isDepthPrePassed()) return;
+
     Primitive::Geometry &geometry = payload.geometry;
-    // clear
+    // clear, the buffers keep their capacity from the last geometry
     vertexes.clear();
-    indexes.clear();
+    clipArena.vertexes.clear();
+    clipArena.indexes.clear();
+    assembledTriangles.clear();
     lightList.clear();
 
-    // copy data
-    Primitive::Material material = geometry.material;
-    geometry.material.diffuseTexture.copyTo(material.diffuseTexture);
+    // copy data, the material and its texture are read in place
+    const Primitive::Material &material = geometry.material;
     for (const auto &light: payload.lightList) {
         lightList.push_back(light);
     }
-    for (auto &vertex: geometry.mesh.vertexes) {
-        vertexes.emplace_back(vertex);
-    }
-    for (auto index: geometry.mesh.indexes) {
-        indexes.push_back(index);
-    }
+    indexes = geometry.mesh.indexes.data();
+    indexCount = geometry.mesh.indexes.size();
+    if (renderOption.renderMode == RenderOption::MODE_LINE_ONLY) meshEdges = &geometry.mesh.getEdges();
 
     transformLights();
     normalMatrix = TransformMatrix::getNormalMatrix(modelMatrix, viewMatrix);
     Eigen::Matrix4f modelViewMatrix = viewMatrix * modelMatrix;
 
-    for (auto &vertex: vertexes) {
-        // apply mvp transformation
-        Shader::basicVertexShader(
-                Shader::VertexShaderPayload{vertex, modelMatrix, viewMatrix, modelViewMatrix, projectionMatrix,
-                                            normalMatrix});
+    // apply mvp transformation
+    bool homogeneous = isHomogeneous();
+    transformVertexes(geometry.mesh.vertexes, modelViewMatrix, homogeneous);
 
-        // apply vertex shader
-        payload.vertexShader(
-                Shader::VertexShaderPayload{vertex, modelMatrix, viewMatrix, modelViewMatrix, projectionMatrix,
-                                            normalMatrix});
+    // apply vertex shader, it may move the verts, then their screen positions and outcodes are computed again
+    auto pVertexShader = payload.vertexShader.target<void (*)(const Shader::VertexShaderPayload &)>();
+    if (!pVertexShader || *pVertexShader != Shader::emptyVertexShader) {
+        for (auto &vertex: vertexes) {
+            payload.vertexShader(
+                    Shader::VertexShaderPayload{vertex, modelMatrix, viewMatrix, modelViewMatrix, projectionMatrix,
+                                                normalMatrix});
+        }
+        for (size_t i = 0; i < vertexes.size(); ++i) {
+            auto &pos = vertexes[i].pos;
+            screenPositions[i] = getScreenPosition(pos, homogeneous);
+            vertexOutcodes[i] = RasterizerKernel::getOutcode(pos.x(), pos.y(), pos.z(), pos.w());
+        }
     }
 
-    std::queue<int> disabledTriangleIndexI;
-    for (int indexesI = 0; indexesI + 2 < indexes.size(); indexesI += 3) {
-        // cull
-        if (renderOption.culling != RenderOption::CULL_NONE && !cullTriangle(indexesI)) {
-            disabledTriangleIndexI.push(indexesI);
-            continue;
+    assembleTriangles(homogeneous);
+
+    // clipping is done, verts of triangles outside the view frustum are mapped as well but never drawn
+    for (size_t i = 0; i < vertexes.size(); ++i) {
+        vertexes[i].pos = screenPositions[i];
+    }
+    for (auto &vertex: clipArena.vertexes) {
+        vertex.pos = getScreenPosition(vertex.pos, homogeneous);
+    }
+
+    Rasterizer rasterizer(screenBuffer, material, payload.fragmentShader);
+    // triangles in the guard band may reach out of the viewport, which clips them as well
+    rasterizer.scissor = scissor.intersect(viewport).intersect(screenBuffer.getRect());
+    auto depthTest = renderOption.zTest ? RasterizerKernel::DEPTH_LESS : RasterizerKernel::DEPTH_ALWAYS;
+    bool depthWrite = renderOption.zWrite;
+    if (renderPass == PASS_SHADING && isDepthPrePassed()) {
+        // the depth buffer is already complete, only shade the pixels whose depth equals it
+        depthTest = RasterizerKernel::DEPTH_LESS_EQUAL;
+        depthWrite = false;
+    }
+    // the g-buffer holds one sample per pixel, deferred geometries are shaded forward when multisampling
+    bool deferred = renderPass != PASS_DEPTH && renderOption.shading == RenderOption::SHADING_DEFERRED &&
+                    !screenBuffer.hasMultisampleBuffer();
+    if (deferred) {
+        screenBuffer.allocateGBuffer();
+        rasterizer.deferredMaterialId = (int) deferredMaterials.size();
+    }
+
+    // pick the raster loop compiled for this depth state, render mode and the varyings the fragment shader reads
+    using RasterizeTrianglesFunction = void (Renderer::*)(Rasterizer &, uint32_t);
+    constexpr auto LESS = RasterizerKernel::DEPTH_LESS, LESS_EQUAL = RasterizerKernel::DEPTH_LESS_EQUAL,
+            ALWAYS = RasterizerKernel::DEPTH_ALWAYS;
+    constexpr auto FILL = RenderOption::MODE_DEFAULT, LINE = RenderOption::MODE_LINE_ONLY;
+    static const RasterizeTrianglesFunction rasterizeTrianglesFunctions[RasterizerKernel::DEPTH_TEST_COUNT][2][2] = {
+            {{&Renderer::rasterizeTrianglesByVaryings<LESS, false, FILL>,
+              &Renderer::rasterizeTrianglesByVaryings<LESS, false, LINE>},
+             {&Renderer::rasterizeTrianglesByVaryings<LESS, true, FILL>,
+              &Renderer::rasterizeTrianglesByVaryings<LESS, true, LINE>}},
+            {{&Renderer::rasterizeTrianglesByVaryings<LESS_EQUAL, false, FILL>,
+              &Renderer::rasterizeTrianglesByVaryings<LESS_EQUAL, false, LINE>},
+             {&Renderer::rasterizeTrianglesByVaryings<LESS_EQUAL, true, FILL>,
+              &Renderer::rasterizeTrianglesByVaryings<LESS_EQUAL, true, LINE>}},
+            {{&Renderer::rasterizeTrianglesByVaryings<ALWAYS, false, FILL>,
+              &Renderer::rasterizeTrianglesByVaryings<ALWAYS, false, LINE>},
+             {&Renderer::rasterizeTrianglesByVaryings<ALWAYS, true, FILL>,
+              &Renderer::rasterizeTrianglesByVaryings<ALWAYS, true, LINE>}},
+    };
+    (this->*rasterizeTrianglesFunctions[depthTest][depthWrite][renderOption.renderMode])(
+            rasterizer, Shader::getFragmentShaderVaryings(payload.fragmentShader));
+
+    if (deferred) {
+        deferredMaterials.push_back({&material, Shader::getFragmentBatchShader(payload.fragmentShader)});
+    }
+}
+
+/**
+ * primitive assembly, cull and clip every triangle of the geometry into `assembledTriangles`,
+ * the cull kernel rejects the culled faces, the edge-on triangles, the ones outside the view frustum and, for the
+ * rasterizers snapping to fixed point, the ones with zero snapped area TRIANGLE_CHUNK_SIZE triangles at a time,
+ * triangles made by clipping are left to the setup of the rasterizers
+ * @param homogeneous only cull the triangles instead of clipping them, the homogeneous rasterizer draws the rest
+ * as they are
+ */
+void Renderer::assembleTriangles(bool homogeneous) {
+    // edge-on triangles cover no pixel, but their edges are still drawn in MODE_LINE_ONLY
+    uint32_t facings = 0;
+    if (renderOption.renderMode == RenderOption::MODE_LINE_ONLY) facings |= RasterizerKernel::FACING_EDGE_ON;
+    if (renderOption.culling != RenderOption::CULL_BACK) facings |= RasterizerKernel::FACING_BACK;
+    if (renderOption.culling != RenderOption::CULL_FRONT) facings |= RasterizerKernel::FACING_FRONT;
+    // the same rasterizer choice as rasterizeTriangles, only these snap with TriangleSetup::setupFixedPoint
+    bool snapped = !homogeneous && renderOption.renderMode == RenderOption::MODE_DEFAULT &&
+                   (renderPass == PASS_DEPTH || screenBuffer.hasMultisampleBuffer() ||
+                    renderOption.rasterization == RenderOption::RASTER_FIXED_POINT);
+    float subpixelStep = snapped ? (float) TriangleSetup::SUBPIXEL_STEP : 0.f;
+
+    const RasterizerKernel::Kernel &kernel = RasterizerKernel::getKernel();
+    constexpr int CHUNK_SIZE = RasterizerKernel::TRIANGLE_CHUNK_SIZE;
+    int triangleCount = (int) (indexCount / 3);
+    RasterizerKernel::TriangleChunk chunk{};
+    for (int first = 0; first < triangleCount; first += CHUNK_SIZE) {
+        int count = std::min(CHUNK_SIZE, triangleCount - first);
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                uint index = indexes[(first + i) * 3 + k];
+                const Eigen::Vector4f &viewSpacePos = vertexes[index].viewSpacePos;
+                for (int c = 0; c < 3; ++c) chunk.viewSpacePos[k][c][i] = viewSpacePos[c];
+                if (snapped) {
+                    for (int c = 0; c < 2; ++c) chunk.screenPos[k][c][i] = screenPositions[index][c];
+                }
+                chunk.outcode[k][i] = vertexOutcodes[index];
+            }
         }
-        // clip
-        if (!clipTriangle(indexesI)) {
-            disabledTriangleIndexI.push(indexesI);
-            continue;
+
+        uint32_t survivors = kernel.cullTriangleChunk(chunk, facings, subpixelStep) & ((1u << count) - 1);
+        for (int i = 0; i < count; ++i) {
+            if (!(survivors & (1u << i))) continue;
+            int indexesI = (first + i) * 3;
+            if (!homogeneous && !clipTriangle(indexesI)) continue;
+            assembledTriangles.push_back({{&vertexes[indexes[indexesI]], &vertexes[indexes[indexesI + 1]],
+                                           &vertexes[indexes[indexesI + 2]]}, indexesI});
         }
     }
 
-    for (auto &vertex: vertexes) {
-        if (!vertex.enabled) continue;
+    // the clip arena is complete, its verts no longer move
+    auto &arenaVertexes = clipArena.vertexes;
+    auto &arenaIndexes = clipArena.indexes;
+    for (size_t indexesI = 0; indexesI + 2 < arenaIndexes.size(); indexesI += 3) {
+        assembledTriangles.push_back({{&arenaVertexes[arenaIndexes[indexesI]],
+                                       &arenaVertexes[arenaIndexes[indexesI + 1]],
+                                       &arenaVertexes[arenaIndexes[indexesI + 2]]}, -1});
+    }
+}
+
+/**
+ * masks with a rasterizer compiled for them are used as they are, the others are rounded up to all varyings
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, RenderOption::RenderMode renderMode>
+void Renderer::rasterizeTrianglesByVaryings(Rasterizer &rasterizer, uint32_t varyingMask) {
+    if (varyingMask == Shader::VARYING_COLOR)
+        rasterizeTriangles<depthTest, depthWrite, renderMode, Shader::VARYING_COLOR>(rasterizer);
+    else if (varyingMask == Shader::VARYING_UV)
+        rasterizeTriangles<depthTest, depthWrite, renderMode, Shader::VARYING_UV>(rasterizer);
+    else
+        rasterizeTriangles<depthTest, depthWrite, renderMode, Shader::VARYING_ALL>(rasterizer);
+}
+
+/**
+ * rasterize every triangle left after culling and clipping, compiled once per depth state, render mode and varying
+ * mask so that z test, z write, the render mode and unused varyings never branch per pixel
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, RenderOption::RenderMode renderMode,
+        uint32_t varyingMask>
+void Renderer::rasterizeTriangles(Rasterizer &rasterizer) {
+    if constexpr (renderMode == RenderOption::MODE_LINE_ONLY) {
+        rasterizeEdges<depthTest, depthWrite, varyingMask>(rasterizer);
+        return;
+    }
+
+    std::array<Primitive::GPUVertex *, 3> triangleVertexes{};
+    RasterizerPayload rasterizerPayload{triangleVertexes, lightList};
+    for (const auto &triangle: assembledTriangles) {
+        triangleVertexes = triangle.vertexes;
+        if (renderPass == PASS_DEPTH)
+            rasterizer.rasterizeTriangleDepth<depthTest, depthWrite>(rasterizerPayload);
+        else if (screenBuffer.hasMultisampleBuffer())
+            rasterizer.rasterizeTriangleMultisample<depthTest, depthWrite, varyingMask>(rasterizerPayload);
+        else if (renderOption.rasterization == RenderOption::RASTER_HOMOGENEOUS)
+            rasterizer.rasterizeTriangleHomogeneous<depthTest, depthWrite, varyingMask>(rasterizerPayload);
+        else if (renderOption.rasterization == RenderOption::RASTER_FIXED_POINT)
+            rasterizer.rasterizeTriangleFixedPoint<depthTest, depthWrite, varyingMask>(rasterizerPayload);
+        else if (renderOption.rasterization == RenderOption::RASTER_EDGE_FUNCTION)
+            rasterizer.rasterizeTriangleEdgeFunction<depthTest, depthWrite, varyingMask>(rasterizerPayload);
+        else
+            rasterizer.rasterizeTriangle<depthTest, depthWrite, varyingMask>(rasterizerPayload);
+    }
+}
 
-        // Homogeneous division
-        // clip_space -> ndc_space
-        vertex.pos.head(3) /= vertex.pos.w();
+/**
+ * draw the wireframe of the geometry, every edge of the mesh is drawn once if any triangle sharing it is drawn,
+ * triangles made by clipping are not in the mesh and their edges are drawn one triangle at a time
+ */
+template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+void Renderer::rasterizeEdges(Rasterizer &rasterizer) {
+    triangleEnabled.assign(indexCount / 3, false);
+    for (const auto &triangle: assembledTriangles) {
+        if (triangle.indexesI >= 0) triangleEnabled[triangle.indexesI / 3] = true;
+    }
 
-        // Viewport transformation
-        // ndc_space -> screen_space
-        // [-1, 1] => [0, width], [-1, 1] => [0, height], [-1, 1] => [0, MAX_DEPTH]
-        vertex.pos.x() = 0.5f * (float) screenBuffer.width * (vertex.pos.x() + 1.f);
-        vertex.pos.y() = 0.5f * (float) screenBuffer.height * (vertex.pos.y() + 1.f);
-        vertex.pos.z() = (vertex.pos.z() + 1.f) / 2.f;
+    std::array<Primitive::GPUVertex *, 3> triangleVertexes{};
+    RasterizerPayload rasterizerPayload{triangleVertexes, lightList};
+    for (auto &edge: *meshEdges) {
+        int k = triangleEnabled[edge.triangles[0] / 3] ? 0 : 1;
+        if (!triangleEnabled[edge.triangles[k] / 3]) continue;
+        rasterizer.rasterizeLine<depthTest, depthWrite, varyingMask>(
+                vertexes[edge.indexes[k][0]], vertexes[edge.indexes[k][1]], rasterizerPayload);
     }
 
-    Rasterizer rasterizer(screenBuffer, material, payload.fragmentShader);
+    for (const auto &triangle: assembledTriangles) {
+        if (triangle.indexesI >= 0) continue;
+        triangleVertexes = triangle.vertexes;
+        rasterizer.rasterizeTriangleLine<depthTest, depthWrite, varyingMask>(rasterizerPayload);
+    }
+}
+
+/**
+ * the lighting pass of deferred shading, apply the fragment shader of its material to every pixel left in the g-buffer,
+ * so that each pixel is shaded exactly once no matter how many fragments were drawn on it
+ */
+void Renderer::shadeDeferred(const std::deque<Primitive::Light> &lights) {
+    if (deferredMaterials.empty()) return;
+
+    lightList.assign(lights.begin(), lights.end());
+    transformLights();
 
-    for (int indexesI = 0; indexesI + 2 < indexes.size(); indexesI += 3) {
-        if (!disabledTriangleIndexI.empty() && indexesI == disabledTriangleIndexI.front()) {
-            disabledTriangleIndexI.pop();
+    // walk the pixels in memory order, every buffer of the g-buffer is read contiguously,
+    // runs of up to a batch of neighbouring pixels with the same material are shaded by one call
+    constexpr int batchSize = Shader::FRAGMENT_BATCH_SIZE;
+    int pixelCount = screenBuffer.width * screenBuffer.height;
+    for (int index = 0; index < pixelCount;) {
+        int materialId = screenBuffer.materialIdBuffer[index];
+        if (materialId < 0) {
+            ++index;
             continue;
         }
+        DeferredMaterial &deferredMaterial = deferredMaterials[materialId];
 
-        std::array<Primitive::GPUVertex *, 3> triangleVertexes{&vertexes[indexes[indexesI]],
-                                                               &vertexes[indexes[indexesI + 1]],
-                                                               &vertexes[indexes[indexesI + 2]]};
-        RasterizerPayload rasterizerPayload{triangleVertexes, lightList};
+        Shader::FragmentBatch fragments{};
+        int count = 0;
+        for (; count < batchSize && index + count < pixelCount &&
+               screenBuffer.materialIdBuffer[index + count] == materialId; ++count) {
+            int pixel = index + count;
+            for (int c = 0; c < 3; ++c) {
+                fragments.viewSpacePos[c][count] = screenBuffer.viewSpacePosBuffer[pixel][c];
+                fragments.color[c][count] = screenBuffer.colorBuffer[pixel][c];
+                fragments.normal[c][count] = screenBuffer.normalBuffer[pixel][c];
+            }
+            fragments.uv[0][count] = screenBuffer.uvBuffer[pixel].x();
+            fragments.uv[1][count] = screenBuffer.uvBuffer[pixel].y();
+        }
+        fragments.coverageMask = (1u << count) - 1;
+
+        Shader::FragmentBatchShaderPayload fragmentBatchShaderPayload{fragments, lightList, *deferredMaterial.material};
+        Shader::basicFragmentBatchShader(fragmentBatchShaderPayload);
+        deferredMaterial.fragmentBatchShader(fragmentBatchShaderPayload);
 
-        if (renderOption.renderMode == RenderOption::MODE_DEFAULT)
-            rasterizer.rasterizeTriangle(rasterizerPayload);
-        else if (renderOption.renderMode == RenderOption::MODE_LINE_ONLY)
-            rasterizer.rasterizeTriangleLine(rasterizerPayload);
+        for (int i = 0; i < count; ++i) {
+            screenBuffer.frameBuffer[index + i] = Eigen::Vector3f(fragments.color[0][i], fragments.color[1][i],
+                                                                  fragments.color[2][i]);
+            screenBuffer.materialIdBuffer[index + i] = -1;
+        }
+        index += count;
     }
+    deferredMaterials.clear();
 }
 
+// panes of the view frustum and the guard band in clip space, dot(pos, paneCoeff) >= 0 inside,
+// indexed by the bit of the pane in the outcode, see RasterizerKernel::Outcode
+static const Eigen::Vector4f paneCoeffs[RasterizerKernel::OUTCODE_PANE_COUNT] = {
+        //near
+        // w_pane = -z, w - w_pane = - w_pane + w = z + w >= 0 -> inside
+        {0,  0,  1,  1},
+        //far
+        // w_pane = z, w - w_pane = - w_pane + w = -z + w >= 0 -> inside
+        {0,  0,  -1, 1},
+        //left
+        // w_pane = -x, w - w_pane = - w_pane + w = x + w >= 0 -> inside
+        {1,  0,  0,  1},
+        //right
+        // w_pane = x, w - w_pane = - w_pane + w = -x + w >= 0 -> inside
+        {-1, 0,  0,  1},
+        //bottom
+        // w_pane = -y, w - w_pane = - w_pane + w = y + w >= 0 -> inside
+        {0,  1,  0,  1},
+        //top
+        // w_pane = y, w - w_pane = - w_pane + w = -y + w >= 0 -> inside
+        {0,  -1, 0,  1},
+        //guard band left, w_pane = -x / GUARD_BAND
+        {1,  0,  0,  RasterizerKernel::GUARD_BAND},
+        //guard band right
+        {-1, 0,  0,  RasterizerKernel::GUARD_BAND},
+        //guard band bottom
+        {0,  1,  0,  RasterizerKernel::GUARD_BAND},
+        //guard band top
+        {0,  -1, 0,  RasterizerKernel::GUARD_BAND},
+};
+
+// a triangle clipped by n panes has at most 3 + n verts
+constexpr int MAX_CLIPPED_VERTEX_COUNT = 9;
+
 /**
- * clip triangle
- * @param indexesI the index of the first vert of the triangle in the `indexes` array
+ * clip triangle, the outcodes of its verts accept most triangles without clipping,
+ * the rest are clipped pane by pane in arrays on the stack
+ * @param indexesI the index of the first vert of the triangle in the `indexes` array, the triangle is not entirely
+ * outside a pane of the view frustum, see assembleTriangles
  * @return should render origin triangle or not
  */
 bool Renderer::clipTriangle(int indexesI) {
-    std::deque<Eigen::Vector4f> paneCoeffs = {
-            //near
-            // w_pane = -z, w - w_pane = - w_pane + w = z + w >= 0 -> inside
-            {0,  0,  1,  1},
-            //far
-            // w_pane = z, w - w_pane = - w_pane + w = -z + w >= 0 -> inside
-            {0,  0,  -1, 1},
-            //left
-            // w_pane = -x, w - w_pane = - w_pane + w = x + w >= 0 -> inside
-            {1,  0,  0,  1},
-            //right
-            // w_pane = x, w - w_pane = - w_pane + w = -x + w >= 0 -> inside
-            {-1, 0,  0,  1},
-            //bottom
-            // w_pane = -y, w - w_pane = - w_pane + w = y + w >= 0 -> inside
-            {0,  1,  0,  1},
-            //top
-            // w_pane = y, w - w_pane = - w_pane + w = -y + w >= 0 -> inside
-            {0,  -1, 0,  1},
-    };
+    uint32_t outcodes[3] = {vertexOutcodes[indexes[indexesI]], vertexOutcodes[indexes[indexesI + 1]],
+                            vertexOutcodes[indexes[indexesI + 2]]};
 
-    bool allInside = true;
-    for (auto &paneCoeff: paneCoeffs) {
-        for (int i = 0; i < 3; ++i) {
-            auto &currV = vertexes[indexes[indexesI + i]];
-            if (currV.pos.dot(paneCoeff) < 0) {
-                allInside = false;
-                currV.enabled = false;
-            }
-        }
-    }
-    if (allInside) return true;
+    // clip only against the near plane and the guard band, or against the whole view frustum
+    uint32_t clipPanes = (outcodes[0] | outcodes[1] | outcodes[2]) &
+                         (renderOption.guardBandClipping ? RasterizerKernel::OUTCODE_GUARD_BAND
+                                                         : RasterizerKernel::OUTCODE_FRUSTUM);
+    if (!clipPanes) return true;
 
-    std::deque<Primitive::GPUVertex> verts;
-    verts.push_back(vertexes[indexes[indexesI + 0]]);
-    verts.push_back(vertexes[indexes[indexesI + 1]]);
-    verts.push_back(vertexes[indexes[indexesI + 2]]);
+    // the polygon is clipped from one array into the other
+    std::array<Primitive::GPUVertex, MAX_CLIPPED_VERTEX_COUNT> vertBuffers[2];
+    Primitive::GPUVertex *verts = vertBuffers[0].data(), *newVerts = vertBuffers[1].data();
+    int vertCount = 3, newVertCount;
+    for (int i = 0; i < 3; ++i) verts[i] = vertexes[indexes[indexesI + i]];
 
-    // clip for w_pane = near/far/left/right/bottom/top
-    for (auto &paneCoeff: paneCoeffs) {
-        std::deque<Primitive::GPUVertex> newVerts;
+    // clip for w_pane = near/far/left/right/bottom/top of the frustum or the guard band, skipping the panes with
+    // every vert inside
+    for (int pane = 0; pane < RasterizerKernel::OUTCODE_PANE_COUNT; ++pane) {
+        if (!(clipPanes & (1u << pane))) continue;
+        const Eigen::Vector4f &paneCoeff = paneCoeffs[pane];
+        newVertCount = 0;
         Primitive::GPUVertex *preV = nullptr;
-        Primitive::GPUVertex *currV = &(verts.back());
+        Primitive::GPUVertex *currV = &verts[vertCount - 1];
         float preD;
         float currD = currV->pos.dot(paneCoeff);
-        for (auto &vert: verts) {
+        for (int i = 0; i < vertCount; ++i) {
             preV = currV;
             preD = currD;
-            currV = &vert;
+            currV = &verts[i];
             currD = currV->pos.dot(paneCoeff);
-            if ((preD >= 0 && currD < 0) || (preD < 0 && currD >= 0)) {
-                newVerts.emplace_back(lineLerp(*preV, *currV, abs(preD) / (abs(preD) + abs(currD))));
-                // Manually set the w value to avoid interpolated wi != -w, which may cause infinite loops
-                newVerts.back().pos.w() = -newVerts.back().pos.head(3).dot(paneCoeff.head(3));
+            // a convex polygon gains at most one vert per pane, but rounding may make a nearly degenerate one cross
+            // a pane more than twice, such a polygon is dropped instead of overrunning the arrays
+            bool crossing = (preD >= 0 && currD < 0) || (preD < 0 && currD >= 0);
+            int pushCount = (int) crossing + (int) (currD >= 0);
+            if (newVertCount + pushCount > MAX_CLIPPED_VERTEX_COUNT) return false;
+            if (crossing) {
+                newVerts[newVertCount] = lineLerp(*preV, *currV, abs(preD) / (abs(preD) + abs(currD)));
+                // Manually set the w value to put the vert exactly on the pane, dot(pos, paneCoeff) = 0, interpolated
+                // w may leave it slightly outside, which may cause infinite loops
+                newVerts[newVertCount].pos.w() =
+                        -newVerts[newVertCount].pos.head(3).dot(paneCoeff.head(3)) / paneCoeff.w();
+                ++newVertCount;
             }
             if (currD >= 0) {
-                newVerts.push_back(*currV);
+                newVerts[newVertCount++] = *currV;
             }
         }
-        if (newVerts.size() < 3) return false;
-        verts = newVerts;
-    }
-
-    // push new vertexes to the back of the `vertexes` array and push new indexes to the back of the `indexes` array
-    vertexes.push_back(verts[0]);
-    int index0 = (int) vertexes.size() - 1;
-    vertexes.push_back(verts[1]);
-    int index1 = (int) vertexes.size() - 1;
-    vertexes.push_back(verts[2]);
-    int index2 = (int) vertexes.size() - 1;
-    indexes.push_back(index0);
-    indexes.push_back(index1);
-    indexes.push_back(index2);
-    for (int i = 3; i < verts.size(); ++i) {
-        index1 = index2;
-        vertexes.push_back(verts[i]);
-        index2 = (int) vertexes.size() - 1;
-        indexes.push_back(index0);
-        indexes.push_back(index1);
-        indexes.push_back(index2);
+        if (newVertCount < 3) return false;
+        std::swap(verts, newVerts);
+        vertCount = newVertCount;
     }
-    return false;
-}
 
-/**
- * cull triangle
- * @param indexesI the index of the first vert of the triangle in the `indexes` array
- * @return should render such triangle or not
- */
-bool Renderer::cullTriangle(int indexesI) {
-    Eigen::Vector3f v1 = vertexes[indexes[indexesI + 1]].viewSpacePos.head(3) * 10 -
-                         vertexes[indexes[indexesI]].viewSpacePos.head(3) * 10;
-    Eigen::Vector3f v2 = vertexes[indexes[indexesI + 2]].viewSpacePos.head(3) * 10 -
-                         vertexes[indexes[indexesI]].viewSpacePos.head(3) * 10;
-    Eigen::Vector3f normal = v2.cross(v1);
-//    Eigen::Vector3f &normal = vertexes[indexes[indexesI]].normal;
-    Eigen::Vector3f toCam = -vertexes[indexes[indexesI]].viewSpacePos.head(3);
-    if (renderOption.culling == RenderOption::CULL_BACK) return normal.dot(toCam) >= 0;
-    else if (renderOption.culling == RenderOption::CULL_FRONT) return normal.dot(toCam) <= 0;
-    return true;
+    // emit the polygon into the clip arena as a fan of triangles, the triangles of the mesh are never touched
+    auto &arenaVertexes = clipArena.vertexes;
+    auto &arenaIndexes = clipArena.indexes;
+    auto index0 = (uint) arenaVertexes.size();
+    arenaVertexes.insert(arenaVertexes.end(), verts, verts + vertCount);
+    for (int i = 2; i < vertCount; ++i) {
+        arenaIndexes.push_back(index0);
+        arenaIndexes.push_back(index0 + i - 1);
+        arenaIndexes.push_back(index0 + i);
+    }
+    return false;
 }
 
 template<typename T>
@@ -6,24 +6,41 @@
 #define CG_BASIC_RENDERER_H
 
 
+#include <array>
 #include <vector>
 #include <eigen3/Eigen/Eigen>
 #include "Primitive.h"
 #include "Shader.h"
+#include "RasterizerKernel.h"
+#include "ScreenBuffer.h"
 
-class ScreenBuffer;
+class Rasterizer;
 
 class CameraObject;
 
 struct RenderOption {
     bool zWrite = true;
     bool zTest = true;
+    // clip triangles only against the near plane and a guard band far outside the screen, the rest of the screen
+    // edges is left to the rasterizers which only walk the pixels on screen, and the far plane to the depth range test
+    bool guardBandClipping = true;
     enum Culling {
         CULL_FRONT, CULL_BACK, CULL_NONE
     } culling = CULL_BACK;
     enum RenderMode {
         MODE_DEFAULT, MODE_LINE_ONLY
     } renderMode = MODE_DEFAULT;
+    enum Rasterization {
+        RASTER_SCANLINE, RASTER_EDGE_FUNCTION, RASTER_FIXED_POINT,
+        // rasterize clip space triangles with homogeneous edge functions instead of clipping them,
+        // lines and multisampling still draw clipped triangles
+        RASTER_HOMOGENEOUS
+    } rasterization = RASTER_FIXED_POINT;
+    // SHADING_DEFERRED writes a g-buffer and shades every covered pixel once in Scene::draw, writing and reading the
+    // g-buffer costs more than it saves unless overdraw is heavy, so forward shading is the default
+    enum Shading {
+        SHADING_FORWARD, SHADING_DEFERRED
+    } shading = SHADING_FORWARD;
 };
 
 struct RendererPayload {
@@ -37,22 +54,89 @@ class Renderer {
 public:
     ScreenBuffer &screenBuffer;
     CameraObject &cameraObject;
-    std::deque<Primitive::GPUVertex> vertexes;
-    std::deque<uint> indexes;
+    // the transformed verts of the mesh being drawn, one for every vert of the mesh, rewritten by every renderGeometry
+    // while keeping their capacity, the indexes of the mesh are read in place
+    std::vector<Primitive::GPUVertex> vertexes;
+    const uint *indexes = nullptr;
+    size_t indexCount = 0;
+    // screen positions of `vertexes`, written with their clip space positions by the vertex stage,
+    // they replace the clip space positions after clipping
+    std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f>> screenPositions;
+    // RasterizerKernel::Outcode bits of the clip space position of every vert in `vertexes`
+    std::vector<uint32_t> vertexOutcodes;
+
+    // triangles made by clipping, kept apart from the verts of the mesh, indexes are into its own verts,
+    // cleared for every geometry without freeing so that its memory stays flat from frame to frame
+    struct ClipArena {
+        std::vector<Primitive::GPUVertex> vertexes;
+        std::vector<uint> indexes;
+    } clipArena;
+
+    // the triangles left after culling and clipping in drawing order, the triangles of the mesh and then the ones made
+    // by clipping, built by primitive assembly so that the raster stage walks them without testing any of them
+    struct AssembledTriangle {
+        std::array<Primitive::GPUVertex *, 3> vertexes;
+        // index of the first vert of a triangle of the mesh in `indexes`, -1 for a triangle made by clipping
+        int indexesI;
+    };
+    std::vector<AssembledTriangle> assembledTriangles;
     Eigen::Matrix4f modelMatrix;
     Eigen::Matrix4f viewMatrix;
     Eigen::Matrix4f projectionMatrix;
     Eigen::Matrix3f normalMatrix;
     std::deque<Primitive::Light> lightList;
     RenderOption renderOption;
+    // the pixels the normalized device coordinates [-1, 1] map to, and the only pixels drawn,
+    // both are the whole screen buffer by default
+    ScreenRect viewport;
+    ScreenRect scissor;
+
+    // PASS_DEPTH and PASS_SHADING are the two passes of a depth pre-pass, see Scene::draw
+    enum RenderPass {
+        PASS_FORWARD, PASS_DEPTH, PASS_SHADING
+    } renderPass = PASS_FORWARD;
+
+    // material and fragment shader of every geometry drawn with SHADING_DEFERRED since the last shadeDeferred,
+    // indexed by the material id in the g-buffer
+    struct DeferredMaterial {
+        const Primitive::Material *material;
+        Shader::FragmentBatchShader fragmentBatchShader;
+    };
+    std::vector<DeferredMaterial> deferredMaterials;
+
+    // unique edges of the mesh being drawn in MODE_LINE_ONLY, see Primitive::Mesh::getEdges, and whether each
+    // triangle of the mesh is drawn, kept from geometry to geometry so that it is not allocated every frame
+    const std::vector<Primitive::Mesh::Edge> *meshEdges = nullptr;
+    std::vector<uint8_t> triangleEnabled;
 
     Renderer(ScreenBuffer &screenBuffer, CameraObject &cameraObject);
 
     void renderGeometry(const RendererPayload &payload);
 
-    bool clipTriangle(int indexesI);
+    bool isDepthPrePassed() const;
+
+    bool isHomogeneous() const;
+
+    Eigen::Vector4f getScreenPosition(const Eigen::Vector4f &clipPos, bool homogeneous) const;
+
+    void transformVertexes(const Primitive::VertexArrays &meshVertexes, const Eigen::Matrix4f &modelViewMatrix,
+                           bool homogeneous);
+
+    void shadeDeferred(const std::deque<Primitive::Light> &lights);
 
-    bool cullTriangle(int indexesI);
+    void assembleTriangles(bool homogeneous);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, RenderOption::RenderMode renderMode>
+    void rasterizeTrianglesByVaryings(Rasterizer &rasterizer, uint32_t varyingMask);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, RenderOption::RenderMode renderMode,
+            uint32_t varyingMask>
+    void rasterizeTriangles(Rasterizer &rasterizer);
+
+    template<RasterizerKernel::DepthTest depthTest, bool depthWrite, uint32_t varyingMask>
+    void rasterizeEdges(Rasterizer &rasterizer);
+
+    bool clipTriangle(int indexesI);
 
     void transformLights();
 
@@ -8,11 +8,29 @@
 #include "ScreenBuffer.h"
 #include "Object.h"
 
+Scene::Scene() = default;
+
+Scene::~Scene() = default;
+
 void Scene::draw() {
     if (!screenBuffer || !cameraObject) return;
-    screenBuffer->clearBuffer();
+    if (multisample) screenBuffer->allocateMultisampleBuffer();
+    else screenBuffer->releaseMultisampleBuffer();
+    ScreenRect screenRect = screenBuffer->getRect();
+    ScreenRect viewportRect = viewport.isEmpty() ? screenRect : viewport;
+    ScreenRect scissorRect = scissor.isEmpty() ? viewportRect : scissor;
+    ScreenRect clearRect = scissorRect.intersect(viewportRect).intersect(screenRect);
+    bool isFullScreen = clearRect.width == screenRect.width && clearRect.height == screenRect.height;
+    if (isFullScreen) screenBuffer->clearBuffer();
+    else screenBuffer->clearBuffer(clearRect);
 
-    Renderer renderer(*screenBuffer, *cameraObject);
+    if (!persistentRenderer || &persistentRenderer->screenBuffer != screenBuffer ||
+        &persistentRenderer->cameraObject != cameraObject)
+        persistentRenderer = std::make_unique<Renderer>(*screenBuffer, *cameraObject);
+    Renderer &renderer = *persistentRenderer;
+    renderer.renderPass = Renderer::PASS_FORWARD;
+    renderer.viewport = viewportRect;
+    renderer.scissor = scissorRect;
     renderer.viewMatrix = TransformMatrix::getViewMatrix(cameraObject->pos,
                                                          cameraObject->toward,
                                                          cameraObject->top);
@@ -20,6 +38,18 @@ void Scene::draw() {
                                                                      cameraObject->aspectRatio,
                                                                      cameraObject->nearPaneZ,
                                                                      cameraObject->farPaneZ);
+    if (depthPrePass) {
+        renderer.renderPass = Renderer::PASS_DEPTH;
+        drawSceneObjects(renderer);
+        renderer.renderPass = Renderer::PASS_SHADING;
+    }
+    drawSceneObjects(renderer);
+    renderer.shadeDeferred(lightList);
+    if (isFullScreen) screenBuffer->resolveMultisample();
+    else screenBuffer->resolveMultisample(clearRect);
+}
+
+void Scene::drawSceneObjects(Renderer &renderer) {
     for (auto pSceneObject: pSceneObjectList) {
         renderer.modelMatrix = TransformMatrix::getModelMatrix(
                 TransformMatrix::getScalingMatrix(pSceneObject->scalingRatio),
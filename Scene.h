@@ -7,11 +7,13 @@
 
 
 #include <deque>
+#include <memory>
 #include "Primitive.h"
 #include "Shader.h"
-class ScreenBuffer;
+#include "ScreenBuffer.h"
 class SceneObject;
 class CameraObject;
+class Renderer;
 
 class Scene {
 public:
@@ -20,7 +22,31 @@ public:
     CameraObject *cameraObject;
     std::deque<Primitive::Light> lightList;
 
+    // draw depth of all objects first, so that every pixel is shaded only once, it rasterizes every triangle twice,
+    // so it only pays off when overdraw makes shading the hidden fragments cost more than that, off by default
+    bool depthPrePass = false;
+
+    // evaluate coverage and depth at ScreenBuffer::SAMPLE_COUNT samples per pixel while shading once per pixel,
+    // the samples are resolved into the frame buffer after all objects are drawn
+    bool multisample = false;
+
+    // the rectangle of the screen buffer the camera draws into, and the only pixels drawn and cleared,
+    // an empty rectangle stands for the whole screen buffer
+    ScreenRect viewport;
+    ScreenRect scissor;
+
+    Scene();
+
+    ~Scene();
+
     void draw();
+
+private:
+    // kept across frames so that its meshes stay uploaded and its buffers allocated,
+    // made again if the screen buffer or the camera changed
+    std::unique_ptr<Renderer> persistentRenderer;
+
+    void drawSceneObjects(Renderer &renderer);
 };
 
 
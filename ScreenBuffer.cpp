@@ -2,6 +2,7 @@
 // Created by admin on 2022/9/23.
 //
 
+#include <algorithm>
 #include "ScreenBuffer.h"
 
 ScreenBuffer::ScreenBuffer(int width, int height) {
@@ -9,6 +10,9 @@ ScreenBuffer::ScreenBuffer(int width, int height) {
     this->height = height;
     frameBuffer.resize(width * height);
     depthBuffer.resize(width * height, 1.f);
+    tileColumns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tileMaxDepthBuffer.resize(tileColumns * tileRows, 1.f);
 }
 
 int ScreenBuffer::getIndex(int x, int y) const {
@@ -19,6 +23,37 @@ int ScreenBuffer::getIndex(int x, int y) const {
 void ScreenBuffer::clearBuffer() {
     for (auto &pixel: frameBuffer) pixel.setZero();
     std::fill(depthBuffer.begin(), depthBuffer.end(), 1.f);
+    std::fill(tileMaxDepthBuffer.begin(), tileMaxDepthBuffer.end(), 1.f);
+    std::fill(materialIdBuffer.begin(), materialIdBuffer.end(), -1);
+    std::fill(sampleDepthBuffer.begin(), sampleDepthBuffer.end(), 1.f);
+    for (auto &sample: sampleColorBuffer) sample.setZero();
+}
+
+// clear only the pixels in rect, the max depth of every tile touching it is reset
+void ScreenBuffer::clearBuffer(const ScreenRect &rect) {
+    ScreenRect clearRect = rect.intersect(getRect());
+    if (clearRect.isEmpty()) return;
+    for (int y = clearRect.y; y < clearRect.y + clearRect.height; ++y) {
+        int begin = getIndex(clearRect.x, y), end = begin + clearRect.width;
+        for (int index = begin; index < end; ++index) frameBuffer[index].setZero();
+        std::fill(depthBuffer.begin() + begin, depthBuffer.begin() + end, 1.f);
+        if (hasGBuffer()) std::fill(materialIdBuffer.begin() + begin, materialIdBuffer.begin() + end, -1);
+        if (hasMultisampleBuffer()) {
+            std::fill(sampleDepthBuffer.begin() + begin * SAMPLE_COUNT, sampleDepthBuffer.begin() + end * SAMPLE_COUNT,
+                      1.f);
+            std::fill(sampleColorBuffer.begin() + begin * SAMPLE_COUNT, sampleColorBuffer.begin() + end * SAMPLE_COUNT,
+                      Eigen::Vector3f::Zero());
+        }
+    }
+    for (int tileY = clearRect.y / TILE_SIZE; tileY <= (clearRect.y + clearRect.height - 1) / TILE_SIZE; ++tileY) {
+        for (int tileX = clearRect.x / TILE_SIZE; tileX <= (clearRect.x + clearRect.width - 1) / TILE_SIZE; ++tileX) {
+            valueInTileMaxDepthBuffer(tileX, tileY) = 1.f;
+        }
+    }
+}
+
+ScreenRect ScreenBuffer::getRect() const {
+    return {0, 0, width, height};
 }
 
 Eigen::Vector3f &ScreenBuffer::valueInFrameBuffer(int x, int y) {
@@ -28,3 +63,85 @@ Eigen::Vector3f &ScreenBuffer::valueInFrameBuffer(int x, int y) {
 float &ScreenBuffer::valueInDepthBuffer(int x, int y) {
     return depthBuffer[getIndex(x, y)];
 }
+
+float &ScreenBuffer::valueInTileMaxDepthBuffer(int tileX, int tileY) {
+    return tileMaxDepthBuffer[tileY * tileColumns + tileX];
+}
+
+// recalculate the max depth of a tile after depth in it is written
+void ScreenBuffer::updateTileMaxDepth(int tileX, int tileY) {
+    int x0 = tileX * TILE_SIZE, x1 = std::min(x0 + TILE_SIZE, width);
+    int y0 = tileY * TILE_SIZE, y1 = std::min(y0 + TILE_SIZE, height);
+    float maxDepth = 0;
+    for (int y = y0; y < y1; ++y) {
+        float *depthRow = &valueInDepthBuffer(0, y);
+        for (int x = x0; x < x1; ++x) {
+            maxDepth = std::max(maxDepth, depthRow[x]);
+        }
+    }
+    valueInTileMaxDepthBuffer(tileX, tileY) = maxDepth;
+}
+
+void ScreenBuffer::allocateGBuffer() {
+    if (hasGBuffer()) return;
+    viewSpacePosBuffer.resize(width * height);
+    colorBuffer.resize(width * height);
+    normalBuffer.resize(width * height);
+    uvBuffer.resize(width * height);
+    materialIdBuffer.resize(width * height, -1);
+}
+
+bool ScreenBuffer::hasGBuffer() const {
+    return !materialIdBuffer.empty();
+}
+
+int &ScreenBuffer::valueInMaterialIdBuffer(int x, int y) {
+    return materialIdBuffer[getIndex(x, y)];
+}
+
+void ScreenBuffer::allocateMultisampleBuffer() {
+    if (hasMultisampleBuffer()) return;
+    sampleDepthBuffer.resize(width * height * SAMPLE_COUNT, 1.f);
+    sampleColorBuffer.resize(width * height * SAMPLE_COUNT, Eigen::Vector3f::Zero());
+}
+
+void ScreenBuffer::releaseMultisampleBuffer() {
+    std::vector<float>().swap(sampleDepthBuffer);
+    std::vector<Eigen::Vector3f>().swap(sampleColorBuffer);
+}
+
+bool ScreenBuffer::hasMultisampleBuffer() const {
+    return !sampleDepthBuffer.empty();
+}
+
+float *ScreenBuffer::samplesInDepthBuffer(int x, int y) {
+    return &sampleDepthBuffer[getIndex(x, y) * SAMPLE_COUNT];
+}
+
+Eigen::Vector3f *ScreenBuffer::samplesInColorBuffer(int x, int y) {
+    return &sampleColorBuffer[getIndex(x, y) * SAMPLE_COUNT];
+}
+
+// average the samples of every pixel into the frame buffer
+void ScreenBuffer::resolveMultisample() {
+    if (!hasMultisampleBuffer()) return;
+    for (int index = 0; index < width * height; ++index) {
+        Eigen::Vector3f color = Eigen::Vector3f::Zero();
+        for (int sample = 0; sample < SAMPLE_COUNT; ++sample) color += sampleColorBuffer[index * SAMPLE_COUNT + sample];
+        frameBuffer[index] = color / SAMPLE_COUNT;
+    }
+}
+
+// average the samples of the pixels inside the rect into the frame buffer
+void ScreenBuffer::resolveMultisample(const ScreenRect &rect) {
+    ScreenRect resolveRect = rect.intersect(getRect());
+    if (!hasMultisampleBuffer() || resolveRect.isEmpty()) return;
+    for (int y = resolveRect.y; y < resolveRect.y + resolveRect.height; ++y) {
+        for (int index = getIndex(resolveRect.x, y); index < getIndex(resolveRect.x, y) + resolveRect.width; ++index) {
+            Eigen::Vector3f color = Eigen::Vector3f::Zero();
+            for (int sample = 0; sample < SAMPLE_COUNT; ++sample)
+                color += sampleColorBuffer[index * SAMPLE_COUNT + sample];
+            frameBuffer[index] = color / SAMPLE_COUNT;
+        }
+    }
+}
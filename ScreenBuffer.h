@@ -6,25 +6,99 @@
 #define CG_BASIC_SCREENBUFFER_H
 
 
+#include <algorithm>
 #include <vector>
 #include <eigen3/Eigen/Core>
 
+// pixels [x, x + width) * [y, y + height) of the screen buffer, y points up
+struct ScreenRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    bool isEmpty() const { return width <= 0 || height <= 0; }
+
+    ScreenRect intersect(const ScreenRect &rect) const {
+        int x0 = std::max(x, rect.x), x1 = std::min(x + width, rect.x + rect.width);
+        int y0 = std::max(y, rect.y), y1 = std::min(y + height, rect.y + rect.height);
+        return {x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0)};
+    }
+};
+
 class ScreenBuffer {
 public:
+    // size of the tiles of the hierarchical z buffer
+    static constexpr int TILE_SIZE = 8;
+
+    // samples per pixel of the multisample buffer and their positions relative to the pixel center
+    // in 1/16 pixel (the standard 4x rotated grid), so that they are exact in 28.4 fixed point
+    static constexpr int SAMPLE_COUNT = 4;
+    static constexpr int ALL_SAMPLES = (1 << SAMPLE_COUNT) - 1;
+    static constexpr int SAMPLE_OFFSETS[SAMPLE_COUNT][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+
     int width;
     int height;
     std::vector<Eigen::Vector3f> frameBuffer;
     std::vector<float> depthBuffer;
 
+    // the max depth of every TILE_SIZE * TILE_SIZE tile in the depth buffer, never smaller than the real one,
+    // the fixed point block and small triangle paths keep it exact, the other paths only raise it when a write
+    // without z test exceeds it (Rasterizer::writeDepth), and clears reset it to 1
+    int tileColumns;
+    int tileRows;
+    std::vector<float> tileMaxDepthBuffer;
+
+    // g-buffer of deferred shading, allocated when the first deferred geometry is drawn,
+    // the material id of a pixel is -1 if it is not waiting for the deferred lighting pass
+    std::vector<Eigen::Vector3f> viewSpacePosBuffer;
+    std::vector<Eigen::Vector3f> colorBuffer;
+    std::vector<Eigen::Vector3f> normalBuffer;
+    std::vector<Eigen::Vector2f> uvBuffer;
+    std::vector<int> materialIdBuffer;
+
+    // depth and color of every sample of a pixel, SAMPLE_COUNT values in a row per pixel, allocated only while
+    // multisampling, resolveMultisample averages them into the frame buffer
+    std::vector<float> sampleDepthBuffer;
+    std::vector<Eigen::Vector3f> sampleColorBuffer;
+
     ScreenBuffer(int width, int height);
 
     void clearBuffer();
 
+    void clearBuffer(const ScreenRect &rect);
+
+    ScreenRect getRect() const;
+
     int getIndex(int x, int y) const;
 
     Eigen::Vector3f &valueInFrameBuffer(int x, int y);
 
     float &valueInDepthBuffer(int x, int y);
+
+    float &valueInTileMaxDepthBuffer(int tileX, int tileY);
+
+    void updateTileMaxDepth(int tileX, int tileY);
+
+    void allocateGBuffer();
+
+    bool hasGBuffer() const;
+
+    int &valueInMaterialIdBuffer(int x, int y);
+
+    void allocateMultisampleBuffer();
+
+    void releaseMultisampleBuffer();
+
+    bool hasMultisampleBuffer() const;
+
+    float *samplesInDepthBuffer(int x, int y);
+
+    Eigen::Vector3f *samplesInColorBuffer(int x, int y);
+
+    void resolveMultisample();
+
+    void resolveMultisample(const ScreenRect &rect);
 };
 
 
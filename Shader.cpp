@@ -58,4 +58,130 @@ namespace Shader {
         }
         payload.color = (La + Ld + Ls) * 255.f;
     }
+
+    /**
+     * varyings read by a fragment shader, the color is also the output of the shader, so a shader which may leave it
+     * unchanged reads the interpolated vertex color, shaders unknown here read all varyings
+     */
+    uint32_t getFragmentShaderVaryings(const std::function<void(const FragmentShaderPayload &)> &fragmentShader) {
+        auto pFragmentShader = fragmentShader.target<void (*)(const FragmentShaderPayload &)>();
+        if (!pFragmentShader) return VARYING_ALL;
+        if (*pFragmentShader == emptyFragmentShader) return VARYING_COLOR;
+        if (*pFragmentShader == textureFragmentShader) return VARYING_UV;
+        // blinn-phong keeps the vertex color when there is no light
+        return VARYING_ALL;
+    }
+
+    void basicFragmentBatchShader(const FragmentBatchShaderPayload &payload) {
+    };
+
+    void emptyFragmentBatchShader(const FragmentBatchShaderPayload &payload) {
+    };
+
+    void textureFragmentBatchShader(const FragmentBatchShaderPayload &payload) {
+        FragmentBatch &fragments = payload.fragments;
+        for (uint32_t i = 0, mask = fragments.coverageMask; mask; ++i, mask >>= 1) {
+            if (!(mask & 1)) continue;
+            Eigen::Vector3f color = payload.material.diffuseTexture.getValue(fragments.uv[0][i], fragments.uv[1][i]);
+            for (int c = 0; c < 3; ++c) fragments.color[c][i] = color[c];
+        }
+    };
+
+    /**
+     * same as blinnPhongFragmentShader, lighting every fragment of the batch at once, the loops over the fragments
+     * have no branch so that the compiler can vectorize them, uncovered fragments are lit as well and thrown away,
+     * except for pow, which is slow on their extrapolated values
+     */
+    void blinnPhongFragmentBatchShader(const FragmentBatchShaderPayload &payload) {
+        if (payload.lights.empty()) return;
+        constexpr int batchSize = FRAGMENT_BATCH_SIZE;
+        FragmentBatch &fragments = payload.fragments;
+        auto &p = fragments.viewSpacePos;
+        auto &n = fragments.normal;
+        Eigen::Vector3f ka = payload.material.ka; // Ambient factor
+        Eigen::Vector3f ks = payload.material.ks; // Specular factor, or called Shininess
+        float ns = payload.material.ns; // Specular range exponent
+
+        // Diffuse factor
+        float kd[3][batchSize];
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < batchSize; ++i) kd[c][i] = payload.material.kd[c];
+        }
+        if (!payload.material.diffuseTexture.isEmpty()) {
+            for (uint32_t i = 0, mask = fragments.coverageMask; mask; ++i, mask >>= 1) {
+                if (!(mask & 1)) continue;
+                Eigen::Vector3f diffuse = payload.material.diffuseTexture.getValue(fragments.uv[0][i],
+                                                                                   fragments.uv[1][i]) / 255.f;
+                for (int c = 0; c < 3; ++c) kd[c][i] = diffuse[c];
+            }
+        }
+
+        Eigen::Vector3f ambientIntensity(0.01, 0.01, 0.01);
+
+        float La[3][batchSize] = {}, Ld[3][batchSize] = {}, Ls[3][batchSize] = {};
+        for (auto &light: payload.lights) {
+            float r2[batchSize], diffuse[batchSize], cos_nh[batchSize], specular[batchSize] = {};
+            for (int i = 0; i < batchSize; ++i) {
+                float lx = light.pos.x() - p[0][i], ly = light.pos.y() - p[1][i], lz = light.pos.z() - p[2][i];
+                float vx = -p[0][i], vy = -p[1][i], vz = -p[2][i];
+                float nx = n[0][i], ny = n[1][i], nz = n[2][i];
+                r2[i] = lx * lx + ly * ly + lz * lz;
+                float lNorm = std::sqrt(r2[i]);
+                float vNorm = std::sqrt(vx * vx + vy * vy + vz * vz);
+                float hx = lx / lNorm + vx / vNorm, hy = ly / lNorm + vy / vNorm, hz = lz / lNorm + vz / vNorm;
+                float hNorm = std::sqrt(hx * hx + hy * hy + hz * hz);
+                float nNorm = std::sqrt(nx * nx + ny * ny + nz * nz);
+                float cos_nl = (nx * lx + ny * ly + nz * lz) / (nNorm * lNorm);
+                cos_nh[i] = (nx * hx + ny * hy + nz * hz) / (nNorm * hNorm);
+                diffuse[i] = MAX(0, cos_nl);
+            }
+            for (uint32_t i = 0, mask = fragments.coverageMask; mask; ++i, mask >>= 1) {
+                if (mask & 1) specular[i] = pow(MAX(0, cos_nh[i]), ns);
+            }
+            for (int c = 0; c < 3; ++c) {
+                for (int i = 0; i < batchSize; ++i) {
+                    La[c][i] += ka[c] * ambientIntensity[c];
+                    Ld[c][i] += kd[c][i] * (light.intensity[c] / r2[i]) * diffuse[i];
+                    Ls[c][i] += ks[c] * (light.intensity[c] / r2[i]) * specular[i];
+                }
+            }
+        }
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < batchSize; ++i) fragments.color[c][i] = (La[c][i] + Ld[c][i] + Ls[c][i]) * 255.f;
+        }
+    }
+
+    /**
+     * run a per pixel fragment shader on every covered fragment of a batch
+     */
+    void adaptFragmentShader(const FragmentBatchShaderPayload &payload,
+                             const std::function<void(const FragmentShaderPayload &)> &fragmentShader) {
+        FragmentBatch &fragments = payload.fragments;
+        for (uint32_t i = 0, mask = fragments.coverageMask; mask; ++i, mask >>= 1) {
+            if (!(mask & 1)) continue;
+            Eigen::Vector3f viewSpacePos(fragments.viewSpacePos[0][i], fragments.viewSpacePos[1][i],
+                                         fragments.viewSpacePos[2][i]);
+            Eigen::Vector3f color(fragments.color[0][i], fragments.color[1][i], fragments.color[2][i]);
+            Eigen::Vector3f normal(fragments.normal[0][i], fragments.normal[1][i], fragments.normal[2][i]);
+            Eigen::Vector2f uv(fragments.uv[0][i], fragments.uv[1][i]);
+            fragmentShader(FragmentShaderPayload{viewSpacePos, color, normal, uv, payload.lights, payload.material});
+            for (int c = 0; c < 3; ++c) fragments.color[c][i] = color[c];
+        }
+    }
+
+    /**
+     * the batch version of a fragment shader, shaders unknown here are adapted by adaptFragmentShader
+     */
+    FragmentBatchShader
+    getFragmentBatchShader(const std::function<void(const FragmentShaderPayload &)> &fragmentShader) {
+        auto pFragmentShader = fragmentShader.target<void (*)(const FragmentShaderPayload &)>();
+        if (pFragmentShader) {
+            if (*pFragmentShader == emptyFragmentShader) return emptyFragmentBatchShader;
+            if (*pFragmentShader == textureFragmentShader) return textureFragmentBatchShader;
+            if (*pFragmentShader == blinnPhongFragmentShader) return blinnPhongFragmentBatchShader;
+        }
+        return [fragmentShader](const FragmentBatchShaderPayload &payload) {
+            adaptFragmentShader(payload, fragmentShader);
+        };
+    }
 }
\ No newline at end of file
@@ -7,19 +7,50 @@
 
 
 #include <functional>
+#include <cstdint>
 #include <eigen3/Eigen/Core>
 #include "Primitive.h"
 
 namespace Shader {
+    // varyings a fragment shader reads, the others are neither set up nor interpolated by the rasterizer
+    enum Varying : uint32_t {
+        VARYING_VIEW_SPACE_POS = 1 << 0,
+        VARYING_COLOR = 1 << 1,
+        VARYING_NORMAL = 1 << 2,
+        VARYING_UV = 1 << 3,
+        VARYING_ALL = VARYING_VIEW_SPACE_POS | VARYING_COLOR | VARYING_NORMAL | VARYING_UV
+    };
+
     struct FragmentShaderPayload {
         Eigen::Vector3f &viewSpacePos;
         Eigen::Vector3f &color;
         Eigen::Vector3f &normal;
         Eigen::Vector2f &uv;
         std::deque<Primitive::Light> &lights;
-        Primitive::Material &material;
+        const Primitive::Material &material;
+    };
+
+    // fragments handed to a batch fragment shader in one call, a span of the rasterizer
+    constexpr int FRAGMENT_BATCH_SIZE = 8;
+
+    // a batch of fragments in structure of arrays, component c of fragment i is at [c][i],
+    // only the fragments whose bit is set in coverageMask are written back, the others may hold any value
+    struct FragmentBatch {
+        uint32_t coverageMask;
+        float viewSpacePos[3][FRAGMENT_BATCH_SIZE];
+        float color[3][FRAGMENT_BATCH_SIZE];
+        float normal[3][FRAGMENT_BATCH_SIZE];
+        float uv[2][FRAGMENT_BATCH_SIZE];
+    };
+
+    struct FragmentBatchShaderPayload {
+        FragmentBatch &fragments;
+        std::deque<Primitive::Light> &lights;
+        const Primitive::Material &material;
     };
 
+    typedef std::function<void(const FragmentBatchShaderPayload &)> FragmentBatchShader;
+
     struct VertexShaderPayload {
         Primitive::GPUVertex &vertex;
         Eigen::Matrix4f &modelMatrix;
@@ -40,6 +71,22 @@ namespace Shader {
     void textureFragmentShader(const FragmentShaderPayload &payload);
 
     void blinnPhongFragmentShader(const FragmentShaderPayload &payload);
+
+    uint32_t getFragmentShaderVaryings(const std::function<void(const FragmentShaderPayload &)> &fragmentShader);
+
+    void basicFragmentBatchShader(const FragmentBatchShaderPayload &payload);
+
+    void emptyFragmentBatchShader(const FragmentBatchShaderPayload &payload);
+
+    void textureFragmentBatchShader(const FragmentBatchShaderPayload &payload);
+
+    void blinnPhongFragmentBatchShader(const FragmentBatchShaderPayload &payload);
+
+    void adaptFragmentShader(const FragmentBatchShaderPayload &payload,
+                             const std::function<void(const FragmentShaderPayload &)> &fragmentShader);
+
+    FragmentBatchShader
+    getFragmentBatchShader(const std::function<void(const FragmentShaderPayload &)> &fragmentShader);
 };
 
 
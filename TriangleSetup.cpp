@@ -0,0 +1,198 @@
+//
+// Created by .torrent on 2026/10/17.
+//
+
+#include <cfloat>
+#include <cmath>
+#include <eigen3/Eigen/LU>
+#include "TriangleSetup.h"
+#include "RasterizerKernel.h"
+
+bool TriangleSetup::setup(const std::array<Primitive::GPUVertex *, 3> &triangleVertexes, const ScreenRect &scissor) {
+    auto &v = triangleVertexes;
+
+    float minPosX = MIN(v[0]->pos.x(), MIN(v[1]->pos.x(), v[2]->pos.x()));
+    float maxPosX = MAX(v[0]->pos.x(), MAX(v[1]->pos.x(), v[2]->pos.x()));
+    float minPosY = MIN(v[0]->pos.y(), MIN(v[1]->pos.y(), v[2]->pos.y()));
+    float maxPosY = MAX(v[0]->pos.y(), MAX(v[1]->pos.y(), v[2]->pos.y()));
+    minX = MAX(scissor.x, (int) ceil(minPosX - 0.5f));
+    maxX = MIN(scissor.x + scissor.width - 1, (int) floor(maxPosX - 0.5f));
+    minY = MAX(scissor.y, (int) ceil(minPosY - 0.5f));
+    maxY = MIN(scissor.y + scissor.height - 1, (int) floor(maxPosY - 0.5f));
+    if (minX > maxX || minY > maxY) return false;
+    originX = (float) minX + 0.5f;
+    originY = (float) minY + 0.5f;
+
+    // E_i(x, y) = (to - from) x (p - from)
+    for (int i = 0; i < 3; ++i) {
+        auto &from = v[(i + 1) % 3]->pos;
+        auto &to = v[(i + 2) % 3]->pos;
+        edges[i].a = from.y() - to.y();
+        edges[i].b = to.x() - from.x();
+        edges[i].c = edges[i].a * (originX - from.x()) + edges[i].b * (originY - from.y());
+    }
+
+    // ignore 'dot' and 'line' triangle
+    area = edges[0].at(v[0]->pos.x() - originX, v[0]->pos.y() - originY);
+    if (area == 0 || _isnanf(area)) return false;
+
+    // flip the edges of a clockwise triangle so that inside is always E_i >= 0
+    if (area < 0) {
+        for (auto &edge: edges) {
+            edge.a = -edge.a;
+            edge.b = -edge.b;
+            edge.c = -edge.c;
+        }
+        area = -area;
+    }
+
+    z = getPlaneEquation(v[0]->pos.z(), v[1]->pos.z(), v[2]->pos.z());
+    return true;
+}
+
+bool TriangleSetup::setupFixedPoint(const std::array<Primitive::GPUVertex *, 3> &triangleVertexes,
+                                    const ScreenRect &scissor, int sampleMargin) {
+    auto &v = triangleVertexes;
+
+    std::array<int64_t, 3> fixedX{}, fixedY{};
+    for (int i = 0; i < 3; ++i) {
+        if (_isnanf(v[i]->pos.x()) || _isnanf(v[i]->pos.y())) return false;
+        fixedX[i] = std::llround(v[i]->pos.x() * (float) SUBPIXEL_STEP);
+        fixedY[i] = std::llround(v[i]->pos.y() * (float) SUBPIXEL_STEP);
+    }
+
+    // pixel x is covered only if its center x * SUBPIXEL_STEP + SUBPIXEL_STEP / 2 (or one of its samples, at most
+    // sampleMargin away from it) is inside the snapped triangle
+    auto halfStep = SUBPIXEL_STEP / 2;
+    auto minFixedX = MIN(fixedX[0], MIN(fixedX[1], fixedX[2])) - halfStep - sampleMargin;
+    auto maxFixedX = MAX(fixedX[0], MAX(fixedX[1], fixedX[2])) - halfStep + sampleMargin;
+    auto minFixedY = MIN(fixedY[0], MIN(fixedY[1], fixedY[2])) - halfStep - sampleMargin;
+    auto maxFixedY = MAX(fixedY[0], MAX(fixedY[1], fixedY[2])) - halfStep + sampleMargin;
+    minX = (int) MAX((int64_t) scissor.x, (minFixedX + SUBPIXEL_STEP - 1) >> SUBPIXEL_BITS);
+    maxX = (int) MIN((int64_t) scissor.x + scissor.width - 1, maxFixedX >> SUBPIXEL_BITS);
+    minY = (int) MAX((int64_t) scissor.y, (minFixedY + SUBPIXEL_STEP - 1) >> SUBPIXEL_BITS);
+    maxY = (int) MIN((int64_t) scissor.y + scissor.height - 1, maxFixedY >> SUBPIXEL_BITS);
+    if (minX > maxX || minY > maxY) return false;
+    originX = (float) minX + 0.5f;
+    originY = (float) minY + 0.5f;
+    int64_t fixedOriginX = ((int64_t) minX << SUBPIXEL_BITS) + halfStep;
+    int64_t fixedOriginY = ((int64_t) minY << SUBPIXEL_BITS) + halfStep;
+
+    // E_i(x, y) = (to - from) x (p - from), in 1/256 pixel^2
+    std::array<int64_t, 3> edgeA{}, edgeB{}, edgeC{};
+    for (int i = 0; i < 3; ++i) {
+        int from = (i + 1) % 3, to = (i + 2) % 3;
+        edgeA[i] = fixedY[from] - fixedY[to];
+        edgeB[i] = fixedX[to] - fixedX[from];
+        edgeC[i] = edgeA[i] * (fixedOriginX - fixedX[from]) + edgeB[i] * (fixedOriginY - fixedY[from]);
+    }
+
+    // ignore 'dot' and 'line' triangle
+    int64_t fixedArea = edgeA[0] * (fixedX[0] - fixedX[1]) + edgeB[0] * (fixedY[0] - fixedY[1]);
+    if (fixedArea == 0) return false;
+
+    // flip the edges of a clockwise triangle so that inside is always E_i >= 0
+    if (fixedArea < 0) {
+        for (int i = 0; i < 3; ++i) {
+            edgeA[i] = -edgeA[i];
+            edgeB[i] = -edgeB[i];
+            edgeC[i] = -edgeC[i];
+        }
+        fixedArea = -fixedArea;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        // top-left fill rule, a pixel center exactly on an edge belongs to the triangle only if the edge is
+        // a left edge (inside is on its right) or a top edge (horizontal, inside is below it, y points up)
+        bool isTopLeft = edgeA[i] > 0 || (edgeA[i] == 0 && edgeB[i] < 0);
+        fixedEdges[i] = {edgeA[i] * SUBPIXEL_STEP, edgeB[i] * SUBPIXEL_STEP, edgeC[i] - (isTopLeft ? 0 : 1)};
+
+        // the float edges of the snapped triangle, only used to build the attribute plane equations
+        edges[i] = {(float) edgeA[i] / SUBPIXEL_STEP, (float) edgeB[i] / SUBPIXEL_STEP,
+                    (float) edgeC[i] / (SUBPIXEL_STEP * SUBPIXEL_STEP)};
+    }
+    area = (float) fixedArea / (SUBPIXEL_STEP * SUBPIXEL_STEP);
+
+    fixedEdgesFitInt32 = true;
+    for (auto &edge: fixedEdges) {
+        int64_t bound = std::abs(edge.c) + std::abs(edge.a) * (maxX - minX + RasterizerKernel::SPAN_SIZE)
+                        + std::abs(edge.b) * (maxY - minY + 1);
+        if (bound > INT32_MAX) fixedEdgesFitInt32 = false;
+    }
+
+    z = getPlaneEquation(v[0]->pos.z(), v[1]->pos.z(), v[2]->pos.z());
+    return true;
+}
+
+bool TriangleSetup::setupHomogeneous(const std::array<Primitive::GPUVertex *, 3> &triangleVertexes,
+                                     const ScreenRect &scissor) {
+    auto &v = triangleVertexes;
+
+    // (E_0, E_1, E_2) = M^-1 * (x, y, 1), the columns of M are the verts (x * w, y * w, w)
+    Eigen::Matrix3d m;
+    for (int i = 0; i < 3; ++i) m.col(i) << v[i]->pos.x(), v[i]->pos.y(), v[i]->pos.w();
+    double det = m.determinant();
+    // ignore 'dot' and 'line' triangle, and those seen edge-on from the eye
+    if (det == 0 || std::isnan(det)) return false;
+    Eigen::Matrix3d inverse = m.inverse();
+
+    // the projection of a triangle in front of the eye bounds it, one crossing the plane of the eye
+    // may cover pixels anywhere in the scissor rectangle
+    minX = scissor.x, maxX = scissor.x + scissor.width - 1, minY = scissor.y, maxY = scissor.y + scissor.height - 1;
+    if (v[0]->pos.w() > 0 && v[1]->pos.w() > 0 && v[2]->pos.w() > 0) {
+        std::array<float, 3> posX{}, posY{};
+        for (int i = 0; i < 3; ++i) {
+            posX[i] = v[i]->pos.x() / v[i]->pos.w();
+            posY[i] = v[i]->pos.y() / v[i]->pos.w();
+        }
+        minX = MAX(minX, (int) ceil(MIN(posX[0], MIN(posX[1], posX[2])) - 0.5f));
+        maxX = MIN(maxX, (int) floor(MAX(posX[0], MAX(posX[1], posX[2])) - 0.5f));
+        minY = MAX(minY, (int) ceil(MIN(posY[0], MIN(posY[1], posY[2])) - 0.5f));
+        maxY = MIN(maxY, (int) floor(MAX(posY[0], MAX(posY[1], posY[2])) - 0.5f));
+    }
+    if (minX > maxX || minY > maxY) return false;
+    originX = (float) minX + 0.5f;
+    originY = (float) minY + 0.5f;
+
+    for (int i = 0; i < 3; ++i) {
+        edges[i].a = (float) inverse(i, 0);
+        edges[i].b = (float) inverse(i, 1);
+        edges[i].c = (float) (inverse(i, 0) * originX + inverse(i, 1) * originY + inverse(i, 2));
+    }
+    area = 1;
+
+    z = getPlaneEquation(v[0]->pos.z(), v[1]->pos.z(), v[2]->pos.z());
+    return true;
+}
+
+TriangleSetup::BlockCoverage TriangleSetup::classifyBlock(int x0, int y0, int x1, int y1, int sampleMargin) const {
+    bool inside = true;
+    for (auto &edge: fixedEdges) {
+        // a and b step a whole pixel, SUBPIXEL_STEP times the margin unit
+        int64_t margin = (std::abs(edge.a) + std::abs(edge.b)) * sampleMargin / SUBPIXEL_STEP;
+        int64_t minEdge = edge.c - margin, maxEdge = edge.c + margin;
+        if (edge.a >= 0) {
+            minEdge += edge.a * (x0 - minX);
+            maxEdge += edge.a * (x1 - minX);
+        } else {
+            minEdge += edge.a * (x1 - minX);
+            maxEdge += edge.a * (x0 - minX);
+        }
+        if (edge.b >= 0) {
+            minEdge += edge.b * (y0 - minY);
+            maxEdge += edge.b * (y1 - minY);
+        } else {
+            minEdge += edge.b * (y1 - minY);
+            maxEdge += edge.b * (y0 - minY);
+        }
+        if (maxEdge < 0) return BLOCK_OUTSIDE;
+        if (minEdge < 0) inside = false;
+    }
+    return inside ? BLOCK_INSIDE : BLOCK_PARTIAL;
+}
+
+float TriangleSetup::getBlockMinZ(int x0, int y0, int x1, int y1) const {
+    auto dx = (float) ((z.a >= 0 ? x0 : x1) - minX);
+    auto dy = (float) ((z.b >= 0 ? y0 : y1) - minY);
+    return z.at(dx, dy) - 4 * FLT_EPSILON;
+}
@@ -0,0 +1,178 @@
+//
+// Created by .torrent on 2026/10/17.
+//
+
+#ifndef CG_BASIC_TRIANGLESETUP_H
+#define CG_BASIC_TRIANGLESETUP_H
+
+#include <array>
+#include <cstdint>
+#include <eigen3/Eigen/Core>
+#include "Primitive.h"
+#include "Shader.h"
+#include "ScreenBuffer.h"
+
+// value(x, y) = a * x + b * y + c, with x and y relative to the origin of the triangle setup
+template<typename T>
+struct PlaneEquation {
+    T a;
+    T b;
+    T c;
+
+    T at(float x, float y) const { return a * x + b * y + c; }
+};
+
+class TriangleSetup {
+public:
+    enum BlockCoverage {
+        BLOCK_OUTSIDE, BLOCK_PARTIAL, BLOCK_INSIDE
+    };
+
+    // 28.4 fixed point screen space positions
+    static constexpr int SUBPIXEL_BITS = 4;
+    static constexpr int SUBPIXEL_STEP = 1 << SUBPIXEL_BITS;
+
+    // pixels whose centers may be inside the triangle, clipped by the scissor rectangle
+    int minX = 0, maxX = -1, minY = 0, maxY = -1;
+
+    // center of pixel (minX, minY), evaluating plane equations relative to it instead of the screen origin
+    // keeps the constant terms small and avoids cancellation on large coordinates
+    float originX = 0, originY = 0;
+
+    // edge i is the edge opposite to vertex i, E_i >= 0 inside the triangle
+    std::array<PlaneEquation<float>, 3> edges{};
+    float area = 0;
+
+    // exact edge functions of the snapped triangle (only built by setupFixedPoint), stepping one pixel
+    // with a and b, the top-left fill rule is folded into c so that inside is always E_i >= 0
+    std::array<PlaneEquation<int64_t>, 3> fixedEdges{};
+
+    // the fixed point edge values stay in int32 over the bounding box (widened to whole spans),
+    // so the simd kernels can evaluate them
+    bool fixedEdgesFitInt32 = false;
+
+    PlaneEquation<float> z{};
+
+    /**
+     * build edge functions and the z plane equation of a screen space triangle
+     * @return false if the triangle covers no pixel
+     */
+    bool setup(const std::array<Primitive::GPUVertex *, 3> &triangleVertexes, const ScreenRect &scissor);
+
+    /**
+     * same as setup, but snap the vertexes to 28.4 fixed point first and build exact edge functions,
+     * so that a pixel center on an edge shared by two triangles is covered by exactly one of them
+     * @param sampleMargin max distance of a sample from the pixel center in 1/16 pixel, widens the bounding box
+     * so that it holds every pixel with a covered sample when multisampling
+     * @return false if the triangle covers no pixel
+     */
+    bool setupFixedPoint(const std::array<Primitive::GPUVertex *, 3> &triangleVertexes, const ScreenRect &scissor,
+                         int sampleMargin = 0);
+
+    /**
+     * set up a triangle of homogeneous screen space positions (x * w, y * w, z * w, w) without dividing them by w,
+     * E_i are the homogeneous 2d edge functions (olano-greer), so that the triangle needs no clipping even if it
+     * crosses the plane of the eye: E_i = barycentric_i / w >= 0 exactly at the visible pixels of it, sum(E_i) = 1 / w
+     * and z / w = sum(z_i * E_i), area is 1 so that getPlaneEquation(value_i) is sum(value_i * E_i)
+     * @return false if the triangle covers no pixel
+     */
+    bool setupHomogeneous(const std::array<Primitive::GPUVertex *, 3> &triangleVertexes, const ScreenRect &scissor);
+
+    /**
+     * classify the pixel centers of block [x0, x1] * [y0, y1] against the fixed point edges
+     * by the corners where each edge function is the smallest and the largest
+     * @param sampleMargin classify every point at most sampleMargin 1/16 pixel away from the pixel centers instead
+     */
+    BlockCoverage classifyBlock(int x0, int y0, int x1, int y1, int sampleMargin = 0) const;
+
+    /**
+     * min z of the triangle plane over the pixel centers of block [x0, x1] * [y0, y1], lowered by a few ulps
+     * so that it is never larger than the z stepped by the rasterizer
+     */
+    float getBlockMinZ(int x0, int y0, int x1, int y1) const;
+
+    // value(x, y) = sum(value_i * E_i(x, y)) / area
+    template<typename T>
+    PlaneEquation<T> getPlaneEquation(const T &value0, const T &value1, const T &value2) const {
+        float invArea = 1.f / area;
+        return {(value0 * edges[0].a + value1 * edges[1].a + value2 * edges[2].a) * invArea,
+                (value0 * edges[0].b + value1 * edges[1].b + value2 * edges[2].b) * invArea,
+                (value0 * edges[0].c + value1 * edges[1].c + value2 * edges[2].c) * invArea};
+    }
+};
+
+/**
+ * the 1/w and varyings/w plane equations of a set up triangle, only the varyings in varyingMask (Shader::Varying)
+ * are packed, in the order viewSpacePos(3), color(3), normal(3), uv(2)
+ */
+template<uint32_t varyingMask>
+class TriangleVaryings {
+public:
+    static constexpr bool HAS_VIEW_SPACE_POS = varyingMask & Shader::VARYING_VIEW_SPACE_POS;
+    static constexpr bool HAS_COLOR = varyingMask & Shader::VARYING_COLOR;
+    static constexpr bool HAS_NORMAL = varyingMask & Shader::VARYING_NORMAL;
+    static constexpr bool HAS_UV = varyingMask & Shader::VARYING_UV;
+
+    static constexpr int VIEW_SPACE_POS_OFFSET = 0;
+    static constexpr int COLOR_OFFSET = VIEW_SPACE_POS_OFFSET + (HAS_VIEW_SPACE_POS ? 3 : 0);
+    static constexpr int NORMAL_OFFSET = COLOR_OFFSET + (HAS_COLOR ? 3 : 0);
+    static constexpr int UV_OFFSET = NORMAL_OFFSET + (HAS_NORMAL ? 3 : 0);
+    static constexpr int SIZE = UV_OFFSET + (HAS_UV ? 2 : 0);
+    typedef Eigen::Matrix<float, SIZE, 1> Varyings;
+
+    PlaneEquation<float> oneOverW{};
+    PlaneEquation<Varyings> varyingsOverW{};
+
+    /**
+     * build the plane equations after TriangleSetup::setup or setupFixedPoint, varyings are interpolated perspective
+     * correctly by interpolating varying / w and 1 / w, then dividing them per pixel
+     */
+    void setup(const TriangleSetup &triangleSetup, const std::array<Primitive::GPUVertex *, 3> &triangleVertexes) {
+        auto &v = triangleVertexes;
+        std::array<float, 3> oneOverWs{};
+        std::array<Varyings, 3> varyingsOverWs;
+        for (int i = 0; i < 3; ++i) {
+            oneOverWs[i] = 1.f / v[i]->pos.w();
+            pack(*v[i], varyingsOverWs[i]);
+            varyingsOverWs[i] *= oneOverWs[i];
+        }
+        oneOverW = triangleSetup.getPlaneEquation(oneOverWs[0], oneOverWs[1], oneOverWs[2]);
+        varyingsOverW = triangleSetup.getPlaneEquation(varyingsOverWs[0], varyingsOverWs[1], varyingsOverWs[2]);
+    }
+
+    /**
+     * build the plane equations after TriangleSetup::setupHomogeneous, whose edge functions already divide
+     * the varyings of the verts by w
+     */
+    void setupHomogeneous(const TriangleSetup &triangleSetup,
+                          const std::array<Primitive::GPUVertex *, 3> &triangleVertexes) {
+        std::array<Varyings, 3> varyingsOfVerts;
+        for (int i = 0; i < 3; ++i) pack(*triangleVertexes[i], varyingsOfVerts[i]);
+        oneOverW = triangleSetup.getPlaneEquation(1.f, 1.f, 1.f);
+        varyingsOverW = triangleSetup.getPlaneEquation(varyingsOfVerts[0], varyingsOfVerts[1], varyingsOfVerts[2]);
+    }
+
+    static void pack(const Primitive::GPUVertex &vertex, Varyings &varyings) {
+        if constexpr (HAS_VIEW_SPACE_POS)
+            varyings.template segment<3>(VIEW_SPACE_POS_OFFSET) = vertex.viewSpacePos.head(3);
+        if constexpr (HAS_COLOR) varyings.template segment<3>(COLOR_OFFSET) = vertex.color;
+        if constexpr (HAS_NORMAL) varyings.template segment<3>(NORMAL_OFFSET) = vertex.normal;
+        if constexpr (HAS_UV) varyings.template segment<2>(UV_OFFSET) = vertex.uv;
+    }
+
+    // varyings not in the mask are set to zero
+    static void unpack(const Varyings &varyings, Eigen::Vector3f &viewSpacePos, Eigen::Vector3f &color,
+                       Eigen::Vector3f &normal, Eigen::Vector2f &uv) {
+        if constexpr (HAS_VIEW_SPACE_POS) viewSpacePos = varyings.template segment<3>(VIEW_SPACE_POS_OFFSET);
+        else viewSpacePos.setZero();
+        if constexpr (HAS_COLOR) color = varyings.template segment<3>(COLOR_OFFSET);
+        else color.setZero();
+        if constexpr (HAS_NORMAL) normal = varyings.template segment<3>(NORMAL_OFFSET).normalized();
+        else normal.setZero();
+        if constexpr (HAS_UV) uv = varyings.template segment<2>(UV_OFFSET);
+        else uv.setZero();
+    }
+};
+
+
+#endif //CG_BASIC_TRIANGLESETUP_H
@@ -128,6 +128,26 @@ void drawGUI(GUIContext &guiContext) {
                     !guiContext.bufferBusy);
             cvui::space(0);
 
+            cvui::text(objName + " Rasterization");
+            guiContext.toolbarComponent.checkBoxes<RenderOption::Rasterization, 4>(
+                    guiContext.scene.pSceneObjectList[i]->renderOption.rasterization,
+                    {RenderOption::RASTER_FIXED_POINT,
+                     RenderOption::RASTER_EDGE_FUNCTION,
+                     RenderOption::RASTER_SCANLINE,
+                     RenderOption::RASTER_HOMOGENEOUS},
+                    {"FIXED_POINT", "EDGE_FUNCTION", "SCANLINE", "HOMOGENEOUS"},
+                    !guiContext.bufferBusy);
+            cvui::space(0);
+
+            cvui::text(objName + " Shading");
+            guiContext.toolbarComponent.checkBoxes<RenderOption::Shading, 2>(
+                    guiContext.scene.pSceneObjectList[i]->renderOption.shading,
+                    {RenderOption::SHADING_FORWARD,
+                     RenderOption::SHADING_DEFERRED},
+                    {"FORWARD", "DEFERRED"},
+                    !guiContext.bufferBusy);
+            cvui::space(0);
+
             cvui::text(objName + " Culling Mode");
             guiContext.toolbarComponent.checkBoxes<RenderOption::Culling, 3>(
                     guiContext.scene.pSceneObjectList[i]->renderOption.culling,
@@ -137,6 +157,30 @@ void drawGUI(GUIContext &guiContext) {
                     {"CULL_BACK", "CULL_FRONT", "CULL_NONE"},
                     !guiContext.bufferBusy);
             cvui::space(0);
+
+            cvui::text(objName + " Z Test");
+            guiContext.toolbarComponent.checkBoxes<bool, 2>(
+                    guiContext.scene.pSceneObjectList[i]->renderOption.zTest,
+                    {true, false},
+                    {"ON", "OFF"},
+                    !guiContext.bufferBusy);
+            cvui::space(0);
+
+            cvui::text(objName + " Z Write");
+            guiContext.toolbarComponent.checkBoxes<bool, 2>(
+                    guiContext.scene.pSceneObjectList[i]->renderOption.zWrite,
+                    {true, false},
+                    {"ON", "OFF"},
+                    !guiContext.bufferBusy);
+            cvui::space(0);
+
+            cvui::text(objName + " Guard Band Clipping");
+            guiContext.toolbarComponent.checkBoxes<bool, 2>(
+                    guiContext.scene.pSceneObjectList[i]->renderOption.guardBandClipping,
+                    {true, false},
+                    {"ON", "OFF"},
+                    !guiContext.bufferBusy);
+            cvui::space(0);
         }
 
         cvui::text("Camera Position");
@@ -157,6 +201,22 @@ void drawGUI(GUIContext &guiContext) {
             cvui::space(0);
         }
 
+        cvui::text("Scene Depth Pre-Pass");
+        guiContext.toolbarComponent.checkBoxes<bool, 2>(
+                guiContext.scene.depthPrePass,
+                {false, true},
+                {"OFF", "ON"},
+                !guiContext.bufferBusy);
+        cvui::space(0);
+
+        cvui::text("Scene 4x MSAA");
+        guiContext.toolbarComponent.checkBoxes<bool, 2>(
+                guiContext.scene.multisample,
+                {false, true},
+                {"OFF", "ON"},
+                !guiContext.bufferBusy);
+        cvui::space(0);
+
         cvui::beginRow(toolbarWidth, -1, padding);
         {
             if (cvui::button("Render")) {
@@ -307,18 +367,20 @@ std::deque<Primitive::Geometry> loadObj(const std::string &pathToObj) {
         if (!mesh.MeshMaterial.map_Kd.empty())
             geometry.material.diffuseTexture = Primitive::Texture(path + mesh.MeshMaterial.map_Kd);
 
-        geometry.mesh.vertexes.resize(mesh.Vertices.size());
+        // write the attributes straight into the arrays of the mesh
+        auto &vertexes = geometry.mesh.vertexes;
+        vertexes.resize(mesh.Vertices.size());
         for (int i = 0; i < mesh.Vertices.size(); ++i) {
-            geometry.mesh.vertexes[i].pos = Eigen::Vector4f(-mesh.Vertices[i].Position.X,
-                                                            mesh.Vertices[i].Position.Y,
-                                                            mesh.Vertices[i].Position.Z,
-                                                            1);
-            geometry.mesh.vertexes[i].normal = Eigen::Vector3f(-mesh.Vertices[i].Normal.X,
-                                                               mesh.Vertices[i].Normal.Y,
-                                                               mesh.Vertices[i].Normal.Z);
-            geometry.mesh.vertexes[i].uv = Eigen::Vector2f(mesh.Vertices[i].TextureCoordinate.X,
-                                                           mesh.Vertices[i].TextureCoordinate.Y);
-            geometry.mesh.vertexes[i].color = Eigen::Vector3f(128, 128, 128);
+            vertexes.pos[0][i] = -mesh.Vertices[i].Position.X;
+            vertexes.pos[1][i] = mesh.Vertices[i].Position.Y;
+            vertexes.pos[2][i] = mesh.Vertices[i].Position.Z;
+            vertexes.pos[3][i] = 1;
+            vertexes.normal[0][i] = -mesh.Vertices[i].Normal.X;
+            vertexes.normal[1][i] = mesh.Vertices[i].Normal.Y;
+            vertexes.normal[2][i] = mesh.Vertices[i].Normal.Z;
+            vertexes.uv[0][i] = mesh.Vertices[i].TextureCoordinate.X;
+            vertexes.uv[1][i] = mesh.Vertices[i].TextureCoordinate.Y;
+            for (int c = 0; c < 3; ++c) vertexes.color[c][i] = 128;
         }
 
         geometry.mesh.indexes.resize(mesh.Indices.size());